@@ -52,13 +52,7 @@ do {										\
 		if (newsize < capacity)						\
 			newsize = capacity;					\
 										\
-		void *newmem = xmalloc(newsize * sizeof(array[0]));		\
-		if (array##_n) {						\
-			memcpy(newmem, array, array##_n * sizeof(array[0]));	\
-		}								\
-		if (array)							\
-			xfree(array);						\
-		array = newmem;							\
+		array = xrealloc(array, newsize * sizeof(array[0]));		\
 		array##_alloc = newsize;					\
 	}									\
 } while (0)
@@ -123,17 +117,24 @@ do {										\
 	array##_n--;								\
 } while (0)
 
+/* O(1), the last element takes the place of the removed one */
+#define ARRAY_REMOVE_UNORDERED(array, index)					\
+do {										\
+	CHECK_ARRAY_BOUNDS(array, index)					\
+	array##_n--;								\
+	if (index != array##_n)							\
+		array[index] = array[array##_n];				\
+} while (0)
+
 #define SHRINK_ARRAY(array)							\
 do {										\
 	if (array##_n == 0) {							\
-		xfree(array);							\
+		if (array)							\
+			xfree(array);						\
 		array = 0;							\
 		array##_alloc = 0;						\
 	} else if (array##_n < array##_alloc) {					\
-		void *newmem = xmalloc(array##_n * sizeof(array[0]));		\
-		memcpy(newmem, array, array##_n * sizeof(array[0]));		\
-		xfree(array);							\
-		array = newmem;							\
+		array = xrealloc(array, array##_n * sizeof(array[0]));		\
 		array##_alloc = array##_n;					\
 	}									\
 } while (0)
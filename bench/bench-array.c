@@ -0,0 +1,186 @@
+/*
+ * Microbenchmark for the array.h growth and removal macros.
+ *
+ * The old growth macro allocated a new block, copied the elements and freed
+ * the old one. It is kept here as OLD_ENSURE_ARRAY_CAPACITY, to compare it
+ * with the realloc based ENSURE_ARRAY_CAPACITY.
+ *
+ * Usage: bench-array [rounds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "array.h"
+
+#define OLD_ENSURE_ARRAY_CAPACITY(array, capacity)				\
+do {										\
+	if (capacity > array##_alloc) {						\
+		size_t newsize = ALLOC_NR(array##_alloc);			\
+		if (newsize < capacity)						\
+			newsize = capacity;					\
+										\
+		void *newmem = xmalloc(newsize * sizeof(array[0]));		\
+		if (array##_n) {						\
+			memcpy(newmem, array, array##_n * sizeof(array[0]));	\
+		}								\
+		if (array)							\
+			xfree(array);						\
+		array = newmem;							\
+		array##_alloc = newsize;					\
+	}									\
+} while (0)
+
+#define OLD_ARRAY_APPEND(array, elt)						\
+do {										\
+	OLD_ENSURE_ARRAY_CAPACITY(array, array##_n + 1);			\
+	array[array##_n++] = elt;						\
+} while (0)
+
+/* same size as the taskbar's "struct taskbar_task" on 64 bit */
+struct elt {
+	unsigned long win;
+	int desktop;
+	int monitor;
+	int x;
+	int w;
+	unsigned char flags[8];
+};
+
+static double now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* keeps the compiler from dropping the loops */
+static volatile size_t sink;
+
+/**************************************************************************
+  Growth
+**************************************************************************/
+
+static double append_old(size_t n, int rounds)
+{
+	double start = now_ms();
+	for (int r = 0; r < rounds; ++r) {
+		struct elt *a;
+		size_t a_n, a_alloc;
+		INIT_EMPTY_ARRAY(a);
+		for (size_t i = 0; i < n; ++i) {
+			struct elt e = {i, 0, 0, 0, 0, {0}};
+			OLD_ARRAY_APPEND(a, e);
+		}
+		sink += a[a_n - 1].win;
+		FREE_ARRAY(a);
+	}
+	return now_ms() - start;
+}
+
+static double append_new(size_t n, int rounds)
+{
+	double start = now_ms();
+	for (int r = 0; r < rounds; ++r) {
+		struct elt *a;
+		size_t a_n, a_alloc;
+		INIT_EMPTY_ARRAY(a);
+		for (size_t i = 0; i < n; ++i) {
+			struct elt e = {i, 0, 0, 0, 0, {0}};
+			ARRAY_APPEND(a, e);
+		}
+		sink += a[a_n - 1].win;
+		FREE_ARRAY(a);
+	}
+	return now_ms() - start;
+}
+
+/**************************************************************************
+  Removal
+**************************************************************************/
+
+static void fill(size_t **a, size_t *a_n, size_t *a_alloc, size_t n)
+{
+	size_t *arr = *a;
+	size_t arr_n = *a_n, arr_alloc = *a_alloc;
+	CLEAR_ARRAY(arr);
+	for (size_t i = 0; i < n; ++i)
+		ARRAY_APPEND(arr, i);
+	*a = arr;
+	*a_n = arr_n;
+	*a_alloc = arr_alloc;
+}
+
+static double remove_ordered(size_t n, int rounds)
+{
+	size_t *a;
+	size_t a_n, a_alloc;
+	INIT_EMPTY_ARRAY(a);
+	double total = 0;
+	for (int r = 0; r < rounds; ++r) {
+		fill(&a, &a_n, &a_alloc, n);
+		srand(r);
+		double start = now_ms();
+		while (a_n) {
+			size_t i = (size_t)rand() % a_n;
+			sink += a[i];
+			ARRAY_REMOVE(a, i);
+		}
+		total += now_ms() - start;
+	}
+	FREE_ARRAY(a);
+	return total;
+}
+
+static double remove_unordered(size_t n, int rounds)
+{
+	size_t *a;
+	size_t a_n, a_alloc;
+	INIT_EMPTY_ARRAY(a);
+	double total = 0;
+	for (int r = 0; r < rounds; ++r) {
+		fill(&a, &a_n, &a_alloc, n);
+		srand(r);
+		double start = now_ms();
+		while (a_n) {
+			size_t i = (size_t)rand() % a_n;
+			sink += a[i];
+			ARRAY_REMOVE_UNORDERED(a, i);
+		}
+		total += now_ms() - start;
+	}
+	FREE_ARRAY(a);
+	return total;
+}
+
+/**************************************************************************
+  Main
+**************************************************************************/
+
+int main(int argc, char **argv)
+{
+	static const size_t sizes[] = {16, 500, 100000};
+	int rounds = 200;
+	if (argc > 1)
+		rounds = atoi(argv[1]);
+	if (rounds <= 0)
+		rounds = 1;
+
+	printf("%-10s %-10s %12s %12s\n", "test", "elements", "old ms", "new ms");
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		size_t n = sizes[i];
+		/* keep the work per size roughly the same */
+		int r = n > 1000 ? rounds / 20 + 1 : rounds * 20;
+		printf("%-10s %-10zu %12.3f %12.3f\n", "append", n,
+		       append_old(n, r), append_new(n, r));
+	}
+
+	/* removal is quadratic with memmove, skip the large size */
+	for (size_t i = 0; i < 2; ++i) {
+		size_t n = sizes[i];
+		int r = rounds * 20;
+		printf("%-10s %-10zu %12.3f %12.3f\n", "remove", n,
+		       remove_ordered(n, r), remove_unordered(n, r));
+	}
+	return 0;
+}
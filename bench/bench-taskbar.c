@@ -0,0 +1,146 @@
+/*
+ * Microbenchmark for the taskbar's per-task loops: visibility filtering,
+ * layout and hit testing, with synthetic tasks.
+ *
+ * The loops are static functions, so the taskbar source is included here.
+ * The theme is empty (no images) and "task_min_width" is zero, the layout
+ * doesn't reach the overflow indicator, which needs a pango layout.
+ *
+ * Usage: bench-taskbar [tasks] [rounds]
+ */
+#include "../widget-taskbar.c"
+
+#define BENCH_DESKTOPS 4
+#define BENCH_MONITORS 2
+#define BENCH_CLASSES 20
+
+static double now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* keeps the compiler from dropping the loops */
+static volatile long sink;
+
+static void fill_tasks(struct taskbar_widget *tw, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; ++i) {
+		char class[32];
+		struct taskbar_task t = {0};
+		struct taskbar_task_data td = {{0}};
+		t.win = 0x1000000 + i;
+		/* some of the tasks are sticky */
+		t.desktop = i % 10 ? (int)(i % BENCH_DESKTOPS) : -1;
+		t.monitor = (int)(i / BENCH_DESKTOPS) % BENCH_MONITORS;
+		t.pinned = i % 50 == 0;
+		snprintf(class, sizeof(class), "Class%d", (int)(i % BENCH_CLASSES));
+		td.wm_class = xstrdup(class);
+		ARRAY_APPEND(tw->tasks, t);
+		ARRAY_APPEND(tw->task_data, td);
+	}
+}
+
+static double bench_visibility(struct widget *w, int rounds)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	double start = now_ms();
+	for (int r = 0; r < rounds; ++r) {
+		tw->desktop = r % BENCH_DESKTOPS;
+		rebuild_visible_tasks(w);
+		sink += tw->visible_n;
+	}
+	return now_ms() - start;
+}
+
+static double bench_layout(struct widget *w, int rounds)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	double start = now_ms();
+	for (int r = 0; r < rounds; ++r) {
+		invalidate_task_layout(tw);
+		layout_tasks(w);
+		sink += tw->spans_n;
+	}
+	return now_ms() - start;
+}
+
+static double bench_hit_test(struct widget *w, int rounds)
+{
+	double start = now_ms();
+	for (int r = 0; r < rounds; ++r) {
+		int x;
+		for (x = w->x; x < w->x + w->width; ++x)
+			sink += get_taskbar_task_at(w, x);
+	}
+	return now_ms() - start;
+}
+
+static double bench_find_window(struct widget *w, int rounds)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	double start = now_ms();
+	for (int r = 0; r < rounds; ++r) {
+		size_t i;
+		for (i = 0; i < tw->tasks_n; i += 7)
+			sink += find_task_by_window(tw, tw->tasks[i].win);
+	}
+	return now_ms() - start;
+}
+
+int main(int argc, char **argv)
+{
+	size_t n = 500;
+	int rounds = 10000;
+	if (argc > 1)
+		n = (size_t)atoi(argv[1]);
+	if (argc > 2)
+		rounds = atoi(argv[2]);
+	if (rounds <= 0)
+		rounds = 1;
+
+	struct panel *p = xmallocz(sizeof(struct panel));
+	struct taskbar_widget tw;
+	struct widget w;
+
+	memset(&tw, 0, sizeof(tw));
+	memset(&w, 0, sizeof(w));
+	w.panel = p;
+	w.x = 0;
+	w.width = 1600;
+	w.private = &tw;
+	tw.highlighted = -1;
+
+	fill_tasks(&tw, n);
+	tw.active = tw.tasks[0].win;
+
+	printf("%zu tasks, %d rounds, %zu+%zu bytes per task\n", n, rounds,
+	       sizeof(struct taskbar_task), sizeof(struct taskbar_task_data));
+	printf("%-24s %10.3f ms\n", "visibility",
+	       bench_visibility(&w, rounds));
+
+	tw.desktop = 0;
+	rebuild_visible_tasks(&w);
+	printf("%-24s %10.3f ms (%zu visible)\n", "layout",
+	       bench_layout(&w, rounds), tw.visible_n);
+	printf("%-24s %10.3f ms (%d pixels)\n", "hit test",
+	       bench_hit_test(&w, rounds / 10 + 1), w.width);
+
+	tw.task_grouping = 1;
+	printf("%-24s %10.3f ms\n", "layout, grouped",
+	       bench_layout(&w, rounds));
+	printf("%-24s %10.3f ms\n", "hit test, grouped",
+	       bench_hit_test(&w, rounds / 10 + 1));
+
+	printf("%-24s %10.3f ms\n", "find by window",
+	       bench_find_window(&w, rounds / 10 + 1));
+
+	free_tasks(&tw);
+	FREE_ARRAY(tw.visible);
+	FREE_ARRAY(tw.buttons);
+	FREE_ARRAY(tw.spans);
+	xfree(p);
+	return 0;
+}
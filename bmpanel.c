@@ -1,11 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
-#include <dirent.h>
 #include <locale.h>
 #include "gui.h"
 #include "config-parser.h"
 #include "xdg.h"
+#include "theme-index.h"
 #include "settings.h"
 #include "widget-utils.h"
 #include "builtin-widgets.h"
@@ -15,63 +15,21 @@
   Listing themes
 **************************************************************************/
 
-static void list_theme(const char *themefile, const char *shortname)
+static void list_theme(const struct theme_index_entry *e)
 {
-	if (!is_file_exists(themefile))
-		return;
-
-	struct config_format_tree tree;
-	if (0 != load_config_format_tree(&tree, themefile))
-		return;
-
-	const char *longname = 0;
-	const char *author = 0;
-	struct config_format_entry *e = find_config_format_entry(&tree.root,
-								 "theme");
-	if (e) {
-		longname = find_config_format_entry_value(e, "name");
-		author = find_config_format_entry_value(e, "author");
-	}
-
-	printf(" * %s", shortname);
-	if (longname || author) {
+	printf(" * %s", e->shortname);
+	if (e->name || e->author) {
 		printf(" (");
-		if (longname) {
-			printf("name: %s", longname);
-			if (author)
+		if (e->name) {
+			printf("name: %s", e->name);
+			if (e->author)
 				printf(", ");
 		}
-		if (author)
-			printf("author: %s", author);
+		if (e->author)
+			printf("author: %s", e->author);
 		printf(")");
 	}
 	printf("\n");
-	free_config_format_tree(&tree);
-}
-
-static void list_themes_in_dir(DIR *d, const char *dirpath)
-{
-	char buf[4096];
-	struct dirent *de;
-	int len;
-
-	while ((de = readdir(d)) != 0) {
-		len = strlen(de->d_name);
-		switch (len) {
-			/* skip current dir and parent dir */
-		case 1:
-			if (de->d_name[0] == '.')
-				continue;
-		case 2:
-			if (de->d_name[0] == '.' && de->d_name[1] == '.')
-				continue;
-		default:
-			break;
-		}
-
-		snprintf(buf, sizeof(buf), "%s/%s/theme", dirpath, de->d_name);
-		list_theme(buf, de->d_name);
-	}
 }
 
 static void list_themes()
@@ -79,22 +37,23 @@ static void list_themes()
 	char buf[4096];
 	size_t data_dirs_len;
 	char **data_dirs = get_XDG_DATA_DIRS(&data_dirs_len);
-	DIR *d;
+	struct theme_index ti;
 
-	size_t i;
+	size_t i, j;
 	for (i = 0; i < data_dirs_len; ++i) {
 		snprintf(buf, sizeof(buf), "%s/bmpanel2/themes", data_dirs[i]);
 		buf[sizeof(buf)-1] = '\0';
 
 		printf("listing themes in \"%s\":\n", buf);
-		d = opendir(buf);
-		if (d) {
-			list_themes_in_dir(d, buf);
-			closedir(d);
+		if (load_theme_index(&ti, buf, 1) == 0) {
+			for (j = 0; j < ti.entries_n; ++j)
+				list_theme(&ti.entries[j]);
 		} else {
 			printf(" - none\n");
 		}
+		free_theme_index(&ti);
 	}
+	free_XDG(data_dirs);
 }
 
 /**************************************************************************
@@ -204,6 +163,7 @@ static void reload_config_and_theme()
 	/* reload */
 	if (load_theme(&theme, theme_override) < 0)
 		XDIE("Failed to load theme");
+	prefetch_images(&theme);
 
 	reconfigure_panel(&p, &theme, &ws, get_monitor());
 	clean_image_cache(0);
@@ -248,6 +208,18 @@ static void sigusr2_handler(int xxx)
 	g_idle_add(reload_config_event, (gpointer)1);
 }
 
+static gboolean memory_stats_event(gpointer data)
+{
+	xmemstat(msrc_subsystems, msrc_subsystems_n, 0);
+	return 0;
+}
+
+/* "kill -RTMIN" prints memory sources counters, release builds too */
+static void sigrtmin_handler(int xxx)
+{
+	g_idle_add(memory_stats_event, 0);
+}
+
 static void mysignal(int sig, void (*handler)(int))
 {
 	struct sigaction sa;
@@ -293,6 +265,8 @@ int main(int argc, char **argv)
 	if (load_theme(&theme, theme_override) < 0)
 		XDIE("Failed to load theme");
 	clean_image_cache(0);
+	prefetch_images(&theme);
+	load_icon_cache();
 
 	init_panel(&p, &theme, get_monitor());
 
@@ -300,14 +274,21 @@ int main(int argc, char **argv)
 	mysignal(SIGTERM, sigterm_handler);
 	mysignal(SIGUSR1, sigusr1_handler);
 	mysignal(SIGUSR2, sigusr2_handler);
+	mysignal(SIGRTMIN, sigrtmin_handler);
 
 	panel_main_loop(&p);
 
+#ifndef NDEBUG
+	print_event_routes_stats(&p);
+#endif
 	free_panel(&p);
+	free_icon_cache();
 	free_config_format_tree(&theme);
 	clean_static_buf();
 	clean_image_cache(1);
 	free_settings();
-	xmemstat(0, 0, 1);
+#ifndef NDEBUG
+	xmemstat(msrc_subsystems, msrc_subsystems_n, 1);
+#endif
 	return EXIT_SUCCESS;
 }
@@ -14,24 +14,38 @@
   Taskbar
 **************************************************************************/
 
+/* Tasks are kept in two parallel arrays: the compact part used by
+ * visibility checks, layout and lookups, and the rest which is touched only
+ * when a task is drawn or updated.
+ */
 struct taskbar_task {
-	struct strbuf name;
-	cairo_surface_t *icon;
 	Window win;
 	int desktop;
+	int monitor; /* for multihead setups */
 	int x;
 	int w;
+	unsigned char pinned;
+	unsigned char demands_attention;
+	unsigned char needs_expose; /* task is in the "dirty" set */
+	unsigned char name_pending; /* name was changed, but not fetched yet */
+	unsigned char visible; /* task is in the "visible" list */
+};
+
+struct taskbar_task_data {
+	struct strbuf name;
+	cairo_surface_t *icon;
 	int geom_x; /* for _NET_WM_ICON_GEOMETRY */
 	int geom_w;
-	int demands_attention;
-	int monitor; /* for multihead setups */
-	int pinned;
 
 	/* I'm using only one name source Atom and I'm watching it for
 	 * updates.
 	 */
 	Atom name_atom;
 	Atom name_type_atom;
+	int64_t name_next_update; /* ms, see "task_title_rate" */
+
+	char *wm_class; /* res_class of WM_CLASS or zero */
+	int group_n; /* windows in the group, if the task shows one */
 };
 
 struct taskbar_state {
@@ -39,12 +53,17 @@ struct taskbar_state {
 	struct text_info font;
 	int icon_offset[2];
 	int exists;
+
+	/* lazy state, "background" is not parsed yet */
+	struct config_format_entry *pending;
+	struct config_format_tree *pending_tree;
 };
 
 struct taskbar_theme {
 	struct taskbar_state states[4];
 	cairo_surface_t *default_icon;
 	int task_max_width;
+	int task_min_width; /* tasks are paged if they don't fit */
 	int default_pinned; /* bool */
 
 	cairo_surface_t *separator;
@@ -58,6 +77,56 @@ struct taskbar_widget {
 	size_t tasks_n;
 	size_t tasks_alloc;
 
+	/* array, parallel to "tasks" */
+	struct taskbar_task_data *task_data;
+	size_t task_data_n;
+	size_t task_data_alloc;
+
+	/* array, indices of the tasks shown on the current desktop and
+	 * monitor, in "tasks" order; it's kept up to date on changes */
+	size_t *visible;
+	size_t visible_n;
+	size_t visible_alloc;
+
+	/* array, indices of the tasks representing groups, in "visible"
+	 * order (see "task_grouping") */
+	size_t *buttons;
+	size_t buttons_n;
+	size_t buttons_alloc;
+
+	/* array, visible task buttons, result of the layout pass */
+	struct span *spans;
+	size_t spans_n;
+	size_t spans_alloc;
+	int layout_valid;
+	int layout_x; /* widget geometry the layout was made for */
+	int layout_width;
+	int geom_dirty; /* some _NET_WM_ICON_GEOMETRY props are outdated */
+
+	/* overflow paging, see "task_min_width" */
+	int page;
+	int pages;
+	Window page_active; /* active window the page was chosen for */
+	int overflow_x; /* indicator position */
+	int overflow_w;
+	int overflow_attention; /* blink phase the indicator was drawn with */
+	int overflow_dirty; /* indicator needs to be repainted */
+
+	/* array, windows of tasks demanding attention */
+	Window *urgent;
+	size_t urgent_n;
+	size_t urgent_alloc;
+
+	/* array, windows of tasks which need to be repainted */
+	Window *dirty;
+	size_t dirty_n;
+	size_t dirty_alloc;
+
+	/* array, windows of tasks with a delayed name fetch */
+	Window *pending_names;
+	size_t pending_names_n;
+	size_t pending_names_alloc;
+
 	Window active;
 	int highlighted;
 	int desktop;
@@ -70,6 +139,8 @@ struct taskbar_widget {
 	/* parameters from bmpanel2rc */
 	int task_death_threshold;
 	int task_urgency_hint;
+	int task_title_rate;
+	int task_grouping;
 	unsigned int task_visible_monitors;
 };
 
@@ -88,6 +159,8 @@ struct clock_theme {
 struct clock_widget {
 	struct clock_theme theme;
 
+	int granularity; /* in seconds, how often the time text changes */
+
 	/* parameters from bmpanel2rc */
 	char *clock_prog;
 	int mouse_button;
@@ -105,6 +178,10 @@ struct desktops_state {
 	cairo_surface_t *right_corner;
 	struct text_info font;
 	int exists;
+
+	/* lazy state, images are not parsed yet */
+	struct config_format_entry *pending;
+	struct config_format_tree *pending_tree;
 };
 
 struct desktops_desktop {
@@ -127,7 +204,6 @@ struct desktops_widget {
 	size_t desktops_n;
 	size_t desktops_alloc;
 
-	int active;
 	int highlighted;
 };
 
@@ -155,6 +231,42 @@ struct pager_theme {
 	int desktop_spacing;
 };
 
+/* see "pager_thumbnails" rc option */
+struct pager_thumbnail {
+	XID damage; /* None if there is no thumbnail */
+	Pixmap pixmap; /* downscaled contents, None until captured */
+	int w;
+	int h;
+
+	/* the size it's drawn at */
+	int want_w;
+	int want_h;
+
+	int64_t next_update; /* ms, see "pager_thumbnail_rate" */
+	unsigned char dirty; /* damaged or resized since the last capture */
+};
+
+struct pager_task {
+	Window win;
+	int desktop; /* -1 for sticky windows */
+
+	/* frame geometry in root coordinates */
+	struct rect geom;
+	unsigned char geom_valid;
+
+	unsigned char on_panel; /* counted by the desktop number */
+	unsigned char on_screen; /* drawn */
+
+	struct pager_thumbnail thumb;
+};
+
+/* indices of the pager "tasks", ascending, i.e. in stacking order */
+struct pager_bucket {
+	size_t *tasks;
+	size_t tasks_n;
+	size_t tasks_alloc;
+};
+
 struct pager_desktop {
 	int x;
 	int w;
@@ -162,19 +274,7 @@ struct pager_desktop {
 	int num_tasks;
 	struct rect workarea;
 	int div; /* use this value to convert window sizes */
-};
-
-struct pager_task {
-	Window win;
-	int x; /* coordinates aren't translated */
-	int y;
-	int w;
-	int h;
-	int visible;
-	int visible_on_panel;
-	int desktop; /* desktop this task affects */
-	int stackpos; /* if it was changed we need to redraw */
-	int alive; /* flag, used when syncing tasks with NETWM */
+	struct pager_bucket bucket;
 };
 
 struct pager_widget {
@@ -185,16 +285,26 @@ struct pager_widget {
 	size_t desktops_n;
 	size_t desktops_alloc;
 
-	int active;
-	int highlighted;
-	Window active_win;
+	/* array, clients in stacking order (bottom to top) */
+	struct pager_task *tasks;
+	size_t tasks_n;
+	size_t tasks_alloc;
 
-	Window *windows; /* from NETWM */
-	int windows_n;
+	/* windows shown on all desktops */
+	struct pager_bucket sticky;
 
-	GHashTable *tasks; /* synced table of windows with retrieved parameters */
+	/* last seen state, to find the desktops to repaint */
+	Window active;
+	int current_desktop;
+
+	/* desktop positions are known, partial redraws are possible */
+	int layout_valid;
+
+	int highlighted;
 
 	int current_monitor_only;
+	int thumbnails; /* bool */
+	int thumbnail_rate;
 };
 
 extern struct widget_interface pager_interface;
@@ -223,6 +333,24 @@ struct systray_icon {
 	Window icon;
 	Window embedder;
 	int mapped;
+
+	/* embedder geometry and panel background generation at the last
+	 * layout, "placed" is zero if the icon was never placed
+	 */
+	int placed;
+	int x;
+	int y;
+	int w;
+	int h;
+	unsigned int bg_generation;
+
+	/* ARGB icons in composite mode: the embedder is redirected
+	 * offscreen and its contents are painted by the panel
+	 */
+	int composited;
+	XID damage;
+	Pixmap pixmap; /* named lazily, None if not yet */
+	int dirty; /* damaged, but not repainted yet */
 };
 
 struct systray_theme {
@@ -241,6 +369,8 @@ struct systray_widget {
 	Atom tray_selection_atom;
 	Window selection_owner;
 	struct systray_theme theme;
+
+	int composite; /* bool, see "systray_composite" rc option */
 };
 
 extern struct widget_interface systray_interface;
@@ -1,3 +1,4 @@
+#define XMALLOC_SOURCE msrc_config
 #include <stdio.h>
 #include "config-parser.h"
 
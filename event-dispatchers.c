@@ -1,12 +1,5 @@
 #include "gui.h"
-
-static inline int point_in_rect(int px, int py, int x, int y, int w, int h)
-{
-	return (px >= x &&
-		px < x + w &&
-		py >= y &&
-		py < y + h);
-}
+#include "array.h"
 
 void disp_button_press_release(struct panel *p, XButtonEvent *e)
 {
@@ -17,33 +10,29 @@ void disp_button_press_release(struct panel *p, XButtonEvent *e)
 		p->last_button = 0;
 	}
 
-	size_t i;
-	for (i = 0; i < p->widgets_n; ++i) {
-		struct widget *w = &p->widgets[i];
-		if (point_in_rect(e->x, e->y, w->x, 0, w->width, p->height)) {
-			if (!p->dnd.taken_on) {
-				if (e->type == ButtonPress) {
-					p->last_click_widget = w;
-					p->last_click_x = e->x;
-					p->last_click_y = e->y;
-					p->last_button = e->button;
-				}
-				if (w->interface->button_click)
-					(*w->interface->button_click)(w, e);
-			} else {
-				if (e->type == ButtonRelease) {
-					p->dnd.dropped_on = w;
-					p->dnd.dropped_x = e->x;
-					p->dnd.dropped_y = e->y;
-					if (w->interface->dnd_drop)
-						(*w->interface->dnd_drop)(w, &p->dnd);
-				}
+	struct widget *w = find_widget_at(p, e->x, e->y);
+	if (w) {
+		if (!p->dnd.taken_on) {
+			if (e->type == ButtonPress) {
+				p->last_click_widget = w;
+				p->last_click_x = e->x;
+				p->last_click_y = e->y;
+				p->last_button = e->button;
+			}
+			if (w->interface->button_click)
+				(*w->interface->button_click)(w, e);
+		} else {
+			if (e->type == ButtonRelease) {
+				p->dnd.dropped_on = w;
+				p->dnd.dropped_x = e->x;
+				p->dnd.dropped_y = e->y;
+				if (w->interface->dnd_drop)
+					(*w->interface->dnd_drop)(w, &p->dnd);
 			}
-			break;
 		}
 	}
 	if (e->type == ButtonRelease && p->dnd.taken_on) {
-		struct widget *w = p->dnd.taken_on;
+		w = p->dnd.taken_on;
 		if (w->interface->dnd_drop && p->dnd.taken_on != p->dnd.dropped_on)
 			(*w->interface->dnd_drop)(w, &p->dnd);
 
@@ -53,34 +42,27 @@ void disp_button_press_release(struct panel *p, XButtonEvent *e)
 
 void disp_motion_notify(struct panel *p, XMotionEvent *e)
 {
-	size_t i;
-
 	/* is there any widget under mouse at all? for example if mouse is on
 	   top of separator, there is no widget under it */
-	int widget_under_mouse = 0;
+	struct widget *w = find_widget_at(p, e->x, e->y);
 
 	/* motion events: enter, leave, motion */
-	for (i = 0; i < p->widgets_n; ++i) {
-		struct widget *w = &p->widgets[i];
-		if (point_in_rect(e->x, e->y, w->x, 0, w->width, p->height)) {
-			if (w == p->under_mouse) {
-				if (w->interface->mouse_motion)
-					(*w->interface->mouse_motion)(w, e);
-			} else {
-				if (p->under_mouse &&
-				    p->under_mouse->interface->mouse_leave)
-				{
-					(*p->under_mouse->interface->
-						mouse_leave)(p->under_mouse);
-				}
-				p->under_mouse = w;
-				if (w->interface->mouse_enter)
-					(*w->interface->mouse_enter)(w);
+	if (w) {
+		if (w == p->under_mouse) {
+			if (w->interface->mouse_motion)
+				(*w->interface->mouse_motion)(w, e);
+		} else {
+			if (p->under_mouse &&
+			    p->under_mouse->interface->mouse_leave)
+			{
+				(*p->under_mouse->interface->
+					mouse_leave)(p->under_mouse);
 			}
-			widget_under_mouse = 1;
+			p->under_mouse = w;
+			if (w->interface->mouse_enter)
+				(*w->interface->mouse_enter)(w);
 		}
-	}
-	if (!widget_under_mouse) {
+	} else {
 		if (p->under_mouse && p->under_mouse->interface->mouse_leave)
 			(*p->under_mouse->interface->mouse_leave)(p->under_mouse);
 		p->under_mouse = 0;
@@ -92,7 +74,7 @@ void disp_motion_notify(struct panel *p, XMotionEvent *e)
 		p->dnd.cur_root_y = e->y_root;
 		p->dnd.cur_x = e->x;
 		p->dnd.cur_y = e->y;
-		struct widget *w = p->dnd.taken_on;
+		w = p->dnd.taken_on;
 		if (w->interface->dnd_drag)
 			(*w->interface->dnd_drag)(w, &p->dnd);
 	}
@@ -102,7 +84,7 @@ void disp_motion_notify(struct panel *p, XMotionEvent *e)
 			|| abs(p->last_click_y - e->y) > p->drag_threshold))
 	{
 		/* drag detected */
-		struct widget *w = p->last_click_widget;
+		w = p->last_click_widget;
 		p->dnd.taken_on = w;
 		p->dnd.taken_x = p->last_click_x;
 		p->dnd.taken_y = p->last_click_y;
@@ -130,42 +112,185 @@ void disp_enter_leave_notify(struct panel *p, XCrossingEvent *e)
 	}
 }
 
+/**************************************************************************
+  Event routing
+**************************************************************************/
+
+static int compare_route(const struct event_route *r, int type, Window win,
+			 Atom atom)
+{
+	if (r->type != type)
+		return r->type < type ? -1 : 1;
+	if (r->win != win)
+		return r->win < win ? -1 : 1;
+	if (r->atom != atom)
+		return r->atom < atom ? -1 : 1;
+	return 0;
+}
+
+/* index of the first route which is not less than the key */
+static size_t find_route(struct panel *p, int type, Window win, Atom atom)
+{
+	size_t lo = 0, hi = p->routes_n;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (compare_route(&p->routes[mid], type, win, atom) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+void add_event_route(struct widget *w, int type, Window win, Atom atom)
+{
+	struct panel *p = w->panel;
+	size_t i = find_route(p, type, win, atom);
+	size_t j;
+	for (j = i; j < p->routes_n; ++j) {
+		if (compare_route(&p->routes[j], type, win, atom))
+			break;
+		if (p->routes[j].w == w)
+			return;
+	}
+
+	struct event_route r = {type, win, atom, w, 0};
+	if (i == p->routes_n)
+		ARRAY_APPEND(p->routes, r);
+	else
+		ARRAY_INSERT_BEFORE(p->routes, i, r);
+}
+
+void remove_event_routes(struct widget *w, Window win)
+{
+	struct panel *p = w->panel;
+	size_t i;
+	for (i = 0; i < p->routes_n; ++i) {
+		if (p->routes[i].w == w && p->routes[i].win == win) {
+			ARRAY_REMOVE(p->routes, i);
+			i--;
+		}
+	}
+}
+
+void rebuild_event_routes(struct panel *p)
+{
+	CLEAR_ARRAY(p->routes);
+	size_t i;
+	for (i = 0; i < p->widgets_n; ++i) {
+		struct widget *w = &p->widgets[i];
+		if (w->interface->add_event_routes)
+			(*w->interface->add_event_routes)(w);
+	}
+}
+
+void free_event_routes(struct panel *p)
+{
+	FREE_ARRAY(p->routes);
+}
+
+void print_event_routes_stats(struct panel *p)
+{
+	size_t i;
+	printf("Event routes (%zu):\n", p->routes_n);
+	for (i = 0; i < p->routes_n; ++i) {
+		struct event_route *r = &p->routes[i];
+		printf("  %-16s type: %2d win: 0x%08lx atom: %4lu hits: %lu\n",
+		       r->w->interface->theme_name, r->type, r->win, r->atom,
+		       r->hits);
+	}
+	fflush(stdout);
+}
+
+/* bit mask of the widgets (by index) interested in the event */
+static unsigned int route_event(struct panel *p, int type, Window win,
+				Atom atom)
+{
+	const Window wins[2] = {win, None};
+	const Atom atoms[2] = {atom, None};
+	unsigned int mask = 0;
+	int wi, ai;
+
+	for (wi = 0; wi < 2; ++wi) {
+		for (ai = 0; ai < 2; ++ai) {
+			if ((wi && win == None) || (ai && atom == None))
+				continue;
+
+			size_t i = find_route(p, type, wins[wi], atoms[ai]);
+			for (; i < p->routes_n; ++i) {
+				struct event_route *r = &p->routes[i];
+				if (compare_route(r, type, wins[wi], atoms[ai]))
+					break;
+				r->hits++;
+				mask |= 1u << (r->w - p->widgets);
+			}
+		}
+	}
+	return mask;
+}
+
 void disp_property_notify(struct panel *p, XPropertyEvent *e)
 {
+	unsigned int mask = route_event(p, PropertyNotify, e->window, e->atom);
 	size_t i;
 	for (i = 0; i < p->widgets_n; ++i) {
 		struct widget *w = &p->widgets[i];
-		if (w->interface->prop_change)
+		if ((mask & (1u << i)) && w->interface->prop_change)
 			(*w->interface->prop_change)(w, e);
 	}
 }
 
 void disp_client_msg(struct panel *p, XClientMessageEvent *e)
 {
+	unsigned int mask = route_event(p, ClientMessage, e->window,
+					e->message_type);
 	size_t i;
 	for (i = 0; i < p->widgets_n; ++i) {
 		struct widget *w = &p->widgets[i];
-		if (w->interface->client_msg)
+		if ((mask & (1u << i)) && w->interface->client_msg)
 			(*w->interface->client_msg)(w, e);
 	}
 }
 
 void disp_win_destroy(struct panel *p, XDestroyWindowEvent *e)
 {
+	unsigned int mask = route_event(p, DestroyNotify, e->window, None);
 	size_t i;
 	for (i = 0; i < p->widgets_n; ++i) {
 		struct widget *w = &p->widgets[i];
-		if (w->interface->win_destroy)
+		if ((mask & (1u << i)) && w->interface->win_destroy)
 			(*w->interface->win_destroy)(w, e);
 	}
 }
 
 void disp_configure(struct panel *p, XConfigureEvent *e)
 {
+	unsigned int mask = route_event(p, ConfigureNotify, e->window, None);
 	size_t i;
 	for (i = 0; i < p->widgets_n; ++i) {
 		struct widget *w = &p->widgets[i];
-		if (w->interface->configure)
+		if ((mask & (1u << i)) && w->interface->configure)
 			(*w->interface->configure)(w, e);
 	}
 }
+
+void disp_damage_notify(struct panel *p, int type, Window win)
+{
+	unsigned int mask = route_event(p, type, win, None);
+	size_t i;
+	for (i = 0; i < p->widgets_n; ++i) {
+		struct widget *w = &p->widgets[i];
+		if ((mask & (1u << i)) && w->interface->damage_notify)
+			(*w->interface->damage_notify)(w, win);
+	}
+}
+
+void disp_client_change(struct panel *p, unsigned int change, Window win)
+{
+	size_t i;
+	for (i = 0; i < p->widgets_n; ++i) {
+		struct widget *w = &p->widgets[i];
+		if (w->interface->client_change)
+			(*w->interface->client_change)(w, change, win);
+	}
+}
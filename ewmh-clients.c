@@ -0,0 +1,381 @@
+#include "array.h"
+#include "ewmh-clients.h"
+
+/**************************************************************************
+  Root window state
+**************************************************************************/
+
+static void free_desktop_names(struct ewmh_clients *cl)
+{
+	int i;
+	for (i = 0; i < cl->desktops_n; ++i) {
+		if (cl->desktop_names[i])
+			xfree(cl->desktop_names[i]);
+	}
+	if (cl->desktop_names)
+		xfree(cl->desktop_names);
+	cl->desktop_names = 0;
+	cl->desktops_n = 0;
+}
+
+static void update_desktops(struct ewmh_clients *cl)
+{
+	struct x_connection *c = cl->connection;
+
+	free_desktop_names(cl);
+	cl->desktops_n = x_get_prop_int(c, c->root,
+					c->atoms[XATOM_NET_NUMBER_OF_DESKTOPS]);
+	if (cl->desktops_n <= 0) {
+		cl->desktops_n = 0;
+		return;
+	}
+	cl->desktop_names = xmallocz(sizeof(char*) * cl->desktops_n);
+
+	int len;
+	char *names = x_get_prop_data(c, c->root,
+				      c->atoms[XATOM_NET_DESKTOP_NAMES],
+				      c->atoms[XATOM_UTF8_STRING], &len);
+	if (!names)
+		return;
+
+	/* names are separated by zeroes, the last one may be not terminated */
+	int i, offset = 0;
+	for (i = 0; i < cl->desktops_n && offset < len; ++i) {
+		size_t namelen = strnlen(names + offset, len - offset);
+		char *name = xmalloc(namelen + 1);
+		memcpy(name, names + offset, namelen);
+		name[namelen] = '\0';
+		cl->desktop_names[i] = name;
+		offset += namelen + 1;
+	}
+	XFree(names);
+}
+
+static void update_active(struct ewmh_clients *cl)
+{
+	struct x_connection *c = cl->connection;
+	cl->active = x_get_prop_window(c, c->root,
+				       c->atoms[XATOM_NET_ACTIVE_WINDOW]);
+}
+
+static void update_current_desktop(struct ewmh_clients *cl)
+{
+	struct x_connection *c = cl->connection;
+	cl->current_desktop = x_get_prop_int(c, c->root,
+					     c->atoms[XATOM_NET_CURRENT_DESKTOP]);
+}
+
+/* returns true if the stacking order was changed */
+static int update_stacking(struct ewmh_clients *cl)
+{
+	struct x_connection *c = cl->connection;
+	int num = 0;
+	Window *wins = x_get_prop_data(c, c->root,
+				       c->atoms[XATOM_NET_CLIENT_LIST_STACKING],
+				       XA_WINDOW, &num);
+	if (!wins)
+		num = 0;
+
+	int changed = (size_t)num != cl->stacking_n ||
+		(num && memcmp(wins, cl->stacking, sizeof(Window) * num));
+	if (changed) {
+		CLEAR_ARRAY(cl->stacking);
+		ENSURE_ARRAY_CAPACITY(cl->stacking, (size_t)num);
+		if (num)
+			memcpy(cl->stacking, wins, sizeof(Window) * num);
+		cl->stacking_n = num;
+	}
+
+	if (wins)
+		XFree(wins);
+	return changed;
+}
+
+/**************************************************************************
+  Clients
+**************************************************************************/
+
+static void notify(struct ewmh_clients *cl, unsigned int change, Window win)
+{
+	if (cl->notify)
+		(*cl->notify)(cl->notify_data, change, win);
+}
+
+static int find_client(struct ewmh_clients *cl, Window win)
+{
+	size_t i;
+	for (i = 0; i < cl->clients_n; ++i) {
+		if (cl->clients[i].win == win)
+			return (int)i;
+	}
+	return -1;
+}
+
+static void add_client(struct ewmh_clients *cl, Window win)
+{
+	struct x_connection *c = cl->connection;
+	struct ewmh_client cc;
+	Window root, parent = None, *children = 0;
+	unsigned int children_n;
+
+	/* all the state is watched via events */
+	x_set_error_trap();
+	if (!x_watch_window(c, win)) {
+		x_done_error_trap();
+		return;
+	}
+	XQueryTree(c->dpy, win, &root, &parent, &children, &children_n);
+	if (children)
+		XFree(children);
+	if (x_done_error_trap())
+		return;
+
+	CLEAR_STRUCT(&cc);
+	cc.win = win;
+	cc.reparented = parent != c->root;
+	cc.desktop = x_get_window_desktop(c, win);
+	ARRAY_APPEND(cl->clients, cc);
+}
+
+/* returns true if the window set was changed */
+static int update_clients(struct ewmh_clients *cl, int notify_changes)
+{
+	struct x_connection *c = cl->connection;
+	int num = 0;
+	Window *wins = x_get_prop_data(c, c->root,
+				       c->atoms[XATOM_NET_CLIENT_LIST],
+				       XA_WINDOW, &num);
+	if (!wins)
+		num = 0;
+
+	int changed = 0;
+	size_t i;
+	int j;
+	for (i = 0; i < cl->clients_n; ++i) {
+		Window win = cl->clients[i].win;
+		for (j = 0; j < num; ++j) {
+			if (wins[j] == win)
+				break;
+		}
+		if (j != num)
+			continue;
+
+		ARRAY_REMOVE(cl->clients, i);
+		i--;
+		changed = 1;
+		if (notify_changes)
+			notify(cl, EWMH_CLIENT_REMOVED, win);
+	}
+
+	for (j = 0; j < num; ++j) {
+		if (find_client(cl, wins[j]) != -1)
+			continue;
+
+		size_t n = cl->clients_n;
+		add_client(cl, wins[j]);
+		if (n == cl->clients_n)
+			continue;
+
+		changed = 1;
+		if (notify_changes)
+			notify(cl, EWMH_CLIENT_ADDED, wins[j]);
+	}
+
+	if (wins)
+		XFree(wins);
+	return changed;
+}
+
+/**************************************************************************
+  Interface
+**************************************************************************/
+
+void ewmh_clients_init(struct ewmh_clients *cl, struct x_connection *c,
+		       ewmh_notify_t notify, void *notify_data)
+{
+	CLEAR_STRUCT(cl);
+	cl->connection = c;
+	INIT_ARRAY(cl->clients, 50);
+	INIT_ARRAY(cl->stacking, 50);
+
+	update_desktops(cl);
+	update_current_desktop(cl);
+	update_active(cl);
+	update_clients(cl, 0);
+	update_stacking(cl);
+
+	/* set it last, nobody is interested in the initial state */
+	cl->notify = notify;
+	cl->notify_data = notify_data;
+}
+
+void ewmh_clients_free(struct ewmh_clients *cl)
+{
+	free_desktop_names(cl);
+	FREE_ARRAY(cl->clients);
+	FREE_ARRAY(cl->stacking);
+}
+
+void ewmh_clients_property_notify(struct ewmh_clients *cl, XPropertyEvent *e)
+{
+	struct x_connection *c = cl->connection;
+
+	if (e->window == c->root) {
+		if (e->atom == c->atoms[XATOM_NET_CLIENT_LIST]) {
+			update_clients(cl, 1);
+			return;
+		}
+		if (e->atom == c->atoms[XATOM_NET_CLIENT_LIST_STACKING]) {
+			if (update_stacking(cl))
+				notify(cl, EWMH_STACKING, None);
+			return;
+		}
+		if (e->atom == c->atoms[XATOM_NET_ACTIVE_WINDOW]) {
+			update_active(cl);
+			notify(cl, EWMH_ACTIVE_WINDOW, None);
+			return;
+		}
+		if (e->atom == c->atoms[XATOM_NET_CURRENT_DESKTOP]) {
+			update_current_desktop(cl);
+			notify(cl, EWMH_CURRENT_DESKTOP, None);
+			return;
+		}
+		if (e->atom == c->atoms[XATOM_NET_NUMBER_OF_DESKTOPS] ||
+		    e->atom == c->atoms[XATOM_NET_DESKTOP_NAMES])
+		{
+			update_desktops(cl);
+			notify(cl, EWMH_DESKTOPS, None);
+			return;
+		}
+		return;
+	}
+
+	int i = find_client(cl, e->window);
+	if (i == -1)
+		return;
+
+	struct ewmh_client *cc = &cl->clients[i];
+	if (e->atom == c->atoms[XATOM_NET_WM_DESKTOP]) {
+		cc->desktop = x_get_window_desktop(c, cc->win);
+		notify(cl, EWMH_CLIENT_DESKTOP, cc->win);
+		return;
+	}
+
+	/* values are cached by xutil, these are invalidated already */
+	if (e->atom == c->atoms[XATOM_NET_WM_STATE] ||
+	    e->atom == c->atoms[XATOM_WM_STATE] ||
+	    e->atom == c->atoms[XATOM_NET_WM_WINDOW_TYPE] ||
+	    e->atom == XA_WM_HINTS)
+	{
+		notify(cl, EWMH_CLIENT_STATE, cc->win);
+		return;
+	}
+
+	if (e->atom == c->atoms[XATOM_NET_FRAME_EXTENTS]) {
+		cc->extents_valid = 0;
+		cc->geometry_valid = 0;
+		notify(cl, EWMH_CLIENT_GEOMETRY, cc->win);
+		return;
+	}
+}
+
+/* extents are cached until their PropertyNotify */
+static void update_frame_extents(struct ewmh_clients *cl, struct ewmh_client *cc)
+{
+	struct x_connection *c = cl->connection;
+	if (cc->extents_valid)
+		return;
+
+	int num = 0;
+	long *extents = x_get_prop_data(c, cc->win,
+					c->atoms[XATOM_NET_FRAME_EXTENTS],
+					XA_CARDINAL, &num);
+	memset(cc->extents, 0, sizeof(cc->extents));
+	if (extents && num >= 4)
+		memcpy(cc->extents, extents, sizeof(cc->extents));
+	if (extents)
+		XFree(extents);
+	cc->extents_valid = 1;
+}
+
+/* x, y, w, h is the client window in root coordinates */
+static void set_client_geometry(struct ewmh_clients *cl, struct ewmh_client *cc,
+				int x, int y, int w, int h)
+{
+	update_frame_extents(cl, cc);
+	cc->x = x - cc->extents[0];
+	cc->y = y - cc->extents[2];
+	cc->w = w + cc->extents[0] + cc->extents[1];
+	cc->h = h + cc->extents[2] + cc->extents[3];
+	cc->geometry_valid = 1;
+}
+
+void ewmh_clients_configure_notify(struct ewmh_clients *cl, XConfigureEvent *e)
+{
+	int i = find_client(cl, e->window);
+	if (i == -1)
+		return;
+
+	/* Synthetic events (ICCCM 4.1.5) and real ones of the windows which
+	 * aren't reparented are in root coordinates, a real event of a
+	 * reparented window tells the position inside the frame only.
+	 */
+	struct ewmh_client *cc = &cl->clients[i];
+	if (e->send_event || !cc->reparented)
+		set_client_geometry(cl, cc, e->x + e->border_width,
+				    e->y + e->border_width, e->width, e->height);
+	else
+		cc->geometry_valid = 0;
+	notify(cl, EWMH_CLIENT_GEOMETRY, e->window);
+}
+
+void ewmh_clients_reparent_notify(struct ewmh_clients *cl, XReparentEvent *e)
+{
+	struct x_connection *c = cl->connection;
+	int i = find_client(cl, e->window);
+	if (i == -1)
+		return;
+
+	struct ewmh_client *cc = &cl->clients[i];
+	cc->reparented = e->parent != c->root;
+	cc->geometry_valid = 0;
+	notify(cl, EWMH_CLIENT_GEOMETRY, e->window);
+}
+
+struct ewmh_client *ewmh_find_client(struct ewmh_clients *cl, Window win)
+{
+	int i = find_client(cl, win);
+	if (i == -1)
+		return 0;
+	return &cl->clients[i];
+}
+
+void ewmh_client_geometry(struct ewmh_clients *cl, struct ewmh_client *cc,
+			  int *x, int *y, int *w, int *h)
+{
+	struct x_connection *c = cl->connection;
+
+	if (!cc->geometry_valid) {
+		XWindowAttributes winattrs;
+		int rx, ry;
+		XGetWindowAttributes(c->dpy, cc->win, &winattrs);
+		x_translate_coordinates(c, 0, 0, &rx, &ry, cc->win);
+		set_client_geometry(cl, cc, rx, ry, winattrs.width,
+				    winattrs.height);
+	}
+
+	*x = cc->x;
+	*y = cc->y;
+	*w = cc->w;
+	*h = cc->h;
+}
+
+void ewmh_switch_desktop(struct ewmh_clients *cl, int desktop)
+{
+	struct x_connection *c = cl->connection;
+	if (desktop >= cl->desktops_n)
+		return;
+
+	x_send_netwm_message(c, c->root, c->atoms[XATOM_NET_CURRENT_DESKTOP],
+			     desktop, 0, 0, 0, 0);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "xutil.h"
+
+/* Client model: the window set and the EWMH state shared by the taskbar,
+ * the pager and the desktop switcher. It applies PropertyNotify and
+ * ConfigureNotify events once and reports what was changed.
+ */
+
+/* changes, "win" is None for the global ones */
+enum ewmh_change {
+	EWMH_CLIENT_ADDED		= 1 << 0,
+	EWMH_CLIENT_REMOVED		= 1 << 1,
+	EWMH_CLIENT_DESKTOP		= 1 << 2,
+	EWMH_CLIENT_STATE		= 1 << 3, /* see x_is_window_* */
+	EWMH_CLIENT_GEOMETRY		= 1 << 4,
+	EWMH_STACKING			= 1 << 5,
+	EWMH_ACTIVE_WINDOW		= 1 << 6,
+	EWMH_CURRENT_DESKTOP		= 1 << 7,
+	EWMH_DESKTOPS			= 1 << 8  /* number of desktops or names */
+};
+
+struct ewmh_client {
+	Window win;
+	int desktop;
+
+	/* frame geometry in root coordinates, see ewmh_client_geometry */
+	int x;
+	int y;
+	int w;
+	int h;
+	int geometry_valid;
+
+	/* _NET_FRAME_EXTENTS: left, right, top, bottom */
+	long extents[4];
+	int extents_valid;
+
+	/* parent is a WM frame, real ConfigureNotify is relative to it */
+	int reparented;
+};
+
+typedef void (*ewmh_notify_t)(void *data, unsigned int change, Window win);
+
+struct ewmh_clients {
+	struct x_connection *connection;
+	ewmh_notify_t notify;
+	void *notify_data;
+
+	/* array, in _NET_CLIENT_LIST order */
+	struct ewmh_client *clients;
+	size_t clients_n;
+	size_t clients_alloc;
+
+	/* array, _NET_CLIENT_LIST_STACKING (bottom to top) */
+	Window *stacking;
+	size_t stacking_n;
+	size_t stacking_alloc;
+
+	Window active;
+	int current_desktop;
+
+	/* array of "desktops_n" names, zero if a desktop has no name */
+	char **desktop_names;
+	int desktops_n;
+};
+
+void ewmh_clients_init(struct ewmh_clients *cl, struct x_connection *c,
+		       ewmh_notify_t notify, void *notify_data);
+void ewmh_clients_free(struct ewmh_clients *cl);
+
+void ewmh_clients_property_notify(struct ewmh_clients *cl, XPropertyEvent *e);
+void ewmh_clients_configure_notify(struct ewmh_clients *cl, XConfigureEvent *e);
+void ewmh_clients_reparent_notify(struct ewmh_clients *cl, XReparentEvent *e);
+
+struct ewmh_client *ewmh_find_client(struct ewmh_clients *cl, Window win);
+
+/* Geometry is taken from ConfigureNotify events where possible, it's
+ * fetched only if an event doesn't tell the root position (a real one for
+ * a reparented window).
+ */
+void ewmh_client_geometry(struct ewmh_clients *cl, struct ewmh_client *cc,
+			  int *x, int *y, int *w, int *h);
+
+void ewmh_switch_desktop(struct ewmh_clients *cl, int desktop);
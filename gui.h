@@ -5,6 +5,7 @@
 #include <glib.h>
 #include "util.h"
 #include "xutil.h"
+#include "ewmh-clients.h"
 #include "config-parser.h"
 
 #define MININT(a, b) ({int _a = (a), _b = (b); _a < _b ? _a : _b; })
@@ -24,6 +25,54 @@
 #define MBUTTON_2_DEFAULT	(MBUTTON_KILL)
 #define MBUTTON_3_DEFAULT	(MBUTTON_PIN)
 
+/**************************************************************************
+  Event routing
+**************************************************************************/
+
+/* Widgets receive PropertyNotify, ClientMessage, ConfigureNotify,
+ * DestroyNotify and XDamageNotify events only through routes (see
+ * add_event_route). "win" and "atom" (property or message type) set to None
+ * match anything.
+ */
+struct event_route {
+	int type;
+	Window win;
+	Atom atom;
+	struct widget *w;
+	unsigned long hits; /* for diagnostics */
+};
+
+/**************************************************************************
+  Hit testing
+**************************************************************************/
+
+/*
+ * Sorted table of non-overlapping horizontal intervals. Used for O(log n)
+ * lookups of "what is under the mouse". Spans must be sorted by "x".
+ */
+struct span {
+	int x;
+	int w;
+	int index; /* user data, usually an index in some array */
+};
+
+/* returns "index" of a span containing "x" or -1 */
+static inline int find_span(const struct span *spans, size_t n, int x)
+{
+	size_t lo = 0, hi = n;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		const struct span *s = &spans[mid];
+		if (x < s->x)
+			hi = mid;
+		else if (x >= s->x + s->w)
+			lo = mid + 1;
+		else
+			return s->index;
+	}
+	return -1;
+}
+
 /**************************************************************************
   Image cache
 **************************************************************************/
@@ -32,6 +81,30 @@
 cairo_surface_t *get_image(const char *path);
 cairo_surface_t *get_image_part(const char *path, int x, int y, int w, int h);
 void clean_image_cache(int);
+/* decodes all PNG files referenced by the theme in parallel */
+void prefetch_images(struct config_format_tree *tree);
+
+/**************************************************************************
+  Icon cache
+**************************************************************************/
+
+/* Scaled window icons, stored on disk between runs (see icon-cache.c).
+ * Hashes are computed by get_window_icon.
+ */
+struct icon_cache_key {
+	uint32_t class_hash; /* res_class of WM_CLASS */
+	uint32_t data_hash; /* the whole _NET_WM_ICON */
+	uint32_t data_len; /* _NET_WM_ICON length */
+	uint16_t width; /* target size */
+	uint16_t height;
+};
+
+void load_icon_cache();
+/* writes new icons to disk */
+void free_icon_cache();
+/* returns a new surface or zero */
+cairo_surface_t *find_cached_icon(const struct icon_cache_key *key);
+void add_cached_icon(const struct icon_cache_key *key, cairo_surface_t *icon);
 
 /**************************************************************************
   Drag'n'drop
@@ -78,8 +151,10 @@ struct widget_interface {
 			struct config_format_tree *tree);
 	void (*destroy_widget_private)(struct widget *w);
 	void (*draw)(struct widget *w);
+	/* repaints dirty parts only, see begin_partial_expose */
+	void (*partial_draw)(struct widget *w);
 	void (*button_click)(struct widget *w, XButtonEvent *e);
-	void (*clock_tick)(struct widget *w); /* every second */
+	void (*clock_tick)(struct widget *w); /* see schedule_widget_tick */
 	void (*prop_change)(struct widget *w, XPropertyEvent *e);
 	void (*mouse_enter)(struct widget *w);
 	void (*mouse_leave)(struct widget *w);
@@ -87,13 +162,23 @@ struct widget_interface {
 	void (*configure)(struct widget *w, XConfigureEvent *e);
 	void (*client_msg)(struct widget *w, XClientMessageEvent *e);
 	void (*win_destroy)(struct widget *w, XDestroyWindowEvent *e);
+	/* "change" is one of EWMH_*, see ewmh-clients.h */
+	void (*client_change)(struct widget *w, unsigned int change, Window win);
 
 	void (*dnd_start)(struct widget *w, struct drag_info *di);
 	void (*dnd_drag)(struct widget *w, struct drag_info *di);
 	void (*dnd_drop)(struct widget *w, struct drag_info *di);
 
+	/* "win" (a drawable of XDamageNotify) contents were changed */
+	void (*damage_notify)(struct widget *w, Window win);
+
+	/* widget adds all its routes here, see rebuild_event_routes */
+	void (*add_event_routes)(struct widget *w);
+
 	/* this is a hack, but it is required for pseudo-transparency */
 	void (*panel_exposed)(struct widget *w);
+	/* called after every expose, flush batched X requests here */
+	void (*expose_done)(struct widget *w);
 	void (*reconfigure)(struct widget *w);
 	int (*retheme_reconfigure)(struct widget *w, struct config_format_entry *e,
 				   struct config_format_tree *tree);
@@ -107,9 +192,13 @@ struct widget {
 	int width;
 
 	int needs_expose;
+	int needs_partial_expose; /* "partial_draw" will be called */
 	int no_separator;
 	int paint_replace; /* for transparent render */
 
+	/* next "clock_tick" time in ms (see get_time_ms), 0 - none */
+	int64_t tick_deadline;
+
 	void *private; /* private part */
 };
 
@@ -151,14 +240,28 @@ struct panel {
 	/* X stuff */
 	Window win;
 	Pixmap bg;
+	/* bumped when the background under child windows may be changed
+	 * (wallpaper, panel size, theme), see systray
+	 */
+	unsigned int bg_generation;
 
 	/* widgets */
 	size_t widgets_n;
 	struct widget widgets[PANEL_MAX_WIDGETS];
 
+	/* non-empty widgets sorted by x (see recalculate_widgets_sizes) */
+	size_t widget_spans_n;
+	struct span widget_spans[PANEL_MAX_WIDGETS];
+
+	/* array, sorted by (type, win, atom) */
+	struct event_route *routes;
+	size_t routes_n;
+	size_t routes_alloc;
+
 	/* "big" things */
 	struct panel_theme theme;
 	struct x_connection connection;
+	struct ewmh_clients clients;
 	cairo_t *cr;
 	PangoLayout *layout;
 	GMainLoop *loop;
@@ -190,6 +293,11 @@ struct panel {
 	/* binded mouse actions */
 	unsigned int mbutton[3];
 
+	/* timer for widget ticks, armed for the earliest "tick_deadline" */
+	guint timer;
+	int64_t timer_deadline;
+	int ticking; /* bool, we're inside of "clock_tick" calls */
+
 	/* render interface */
 	struct render_interface *render;
 	void *render_private;
@@ -232,6 +340,27 @@ void reconfigure_widgets(struct panel *panel);
 void panel_main_loop(struct panel *panel);
 
 void recalculate_widgets_sizes(struct panel *panel);
+
+/*
+ * Widget timers. The panel sleeps until the earliest requested deadline and
+ * calls "clock_tick" of each widget whose deadline has passed. A deadline is
+ * cleared before the call, a widget should schedule the next one itself if it
+ * wants to be called again. Deadlines further than a second away are served
+ * by g_timeout_add_seconds, which batches wakeups with other timers and may
+ * fire up to a second late.
+ */
+/* monotonic, not affected by wall clock changes */
+int64_t get_time_ms();
+void schedule_widget_tick(struct widget *w, int64_t deadline);
+
+/*
+ * Partial exposing. Used by "partial_draw" implementations: each dirty area
+ * of a widget should be wrapped in begin/end calls, "begin" fills the area
+ * with the panel background and clips drawing to it, "end" blits the area.
+ */
+void begin_partial_expose(struct widget *w, int x, int width);
+void end_partial_expose(struct widget *w, int x, int width);
+struct widget *find_widget_at(struct panel *panel, int x, int y);
 int check_mbutton_condition(struct panel *panel, int mbutton, unsigned int condition);
 
 /* event dispatchers */
@@ -242,3 +371,17 @@ void disp_enter_leave_notify(struct panel *p, XCrossingEvent *e);
 void disp_client_msg(struct panel *p, XClientMessageEvent *e);
 void disp_win_destroy(struct panel *p, XDestroyWindowEvent *e);
 void disp_configure(struct panel *p, XConfigureEvent *e);
+void disp_client_change(struct panel *p, unsigned int change, Window win);
+void disp_damage_notify(struct panel *p, int type, Window win);
+
+/*
+ * Event routes. Routes are dropped when widgets are recreated, after that
+ * "add_event_routes" of each widget is called, so it should add routes for
+ * all its current state (e.g. all task windows). Between these widgets add
+ * and remove routes as windows come and go.
+ */
+void add_event_route(struct widget *w, int type, Window win, Atom atom);
+void remove_event_routes(struct widget *w, Window win);
+void rebuild_event_routes(struct panel *p);
+void free_event_routes(struct panel *p);
+void print_event_routes_stats(struct panel *p);
@@ -0,0 +1,286 @@
+#define XMALLOC_SOURCE msrc_icons
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "gui.h"
+#include "array.h"
+#include "xdg.h"
+
+/* Window icons scaled to the taskbar icon size, kept between runs. The pack
+ * file is mapped on startup and rewritten on exit if there are new icons:
+ *
+ *   struct icon_cache_header
+ *   struct icon_cache_record[entries_n]
+ *   pixels (premultiplied ARGB32, width * height per record)
+ */
+
+#define ICON_CACHE_MAGIC 0x43494d42 /* "BMIC" */
+#define ICON_CACHE_VERSION 3
+#define ICON_CACHE_BYTE_ORDER 0x01020304
+#define ICON_CACHE_MAX_ENTRIES 512
+
+struct icon_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t entries_n;
+};
+
+struct icon_cache_record {
+	struct icon_cache_key key;
+	uint32_t offset;
+	uint32_t reserved;
+};
+
+struct icon_cache_entry {
+	struct icon_cache_key key;
+	const uint32_t *pixels; /* mapped or owned */
+	int owned;
+	int used; /* was requested during this run */
+};
+
+static struct icon_cache_entry *entries;
+static size_t entries_n;
+static size_t entries_alloc;
+
+static void *map;
+static size_t map_size;
+static char *cache_path;
+static int dirty;
+
+static char *get_cache_path(const char *suffix)
+{
+	char *dir = get_XDG_CACHE_HOME();
+	if (!dir)
+		return 0;
+
+	char *path = xmalloc(strlen(dir) + sizeof("/bmpanel2/icons") +
+			     strlen(suffix));
+	sprintf(path, "%s/bmpanel2/icons%s", dir, suffix);
+	xfree(dir);
+	return path;
+}
+
+static int read_pack(void *data, size_t size)
+{
+	const struct icon_cache_header *h = data;
+	if (size < sizeof(*h) || h->magic != ICON_CACHE_MAGIC ||
+	    h->version != ICON_CACHE_VERSION ||
+	    h->byte_order != ICON_CACHE_BYTE_ORDER ||
+	    h->entries_n > ICON_CACHE_MAX_ENTRIES ||
+	    size < sizeof(*h) + h->entries_n * sizeof(struct icon_cache_record))
+		return -1;
+
+	const struct icon_cache_record *r = (const void*)(h + 1);
+	uint32_t i;
+	for (i = 0; i < h->entries_n; ++i, ++r) {
+		size_t len = (size_t)r->key.width * r->key.height * 4;
+		if (r->offset % 4 || r->offset > size || len > size - r->offset)
+			return -1;
+	}
+
+	r = (const void*)(h + 1);
+	for (i = 0; i < h->entries_n; ++i, ++r) {
+		struct icon_cache_entry e;
+		CLEAR_STRUCT(&e);
+		e.key = r->key;
+		e.pixels = (const uint32_t*)((const char*)data + r->offset);
+		ARRAY_APPEND(entries, e);
+	}
+	return 0;
+}
+
+void load_icon_cache()
+{
+	INIT_EMPTY_ARRAY(entries);
+	cache_path = get_cache_path("");
+	if (!cache_path)
+		return;
+
+	int fd = open(cache_path, O_RDONLY);
+	if (fd == -1)
+		return;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		map_size = st.st_size;
+		map = mmap(0, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED)
+			map = 0;
+	}
+	close(fd);
+
+	if (map && read_pack(map, map_size)) {
+		XWARNING("Ignoring broken icon cache: \"%s\"", cache_path);
+		CLEAR_ARRAY(entries);
+	}
+}
+
+static int write_pack(FILE *f)
+{
+	struct icon_cache_header h;
+	size_t i, n = 0;
+
+	/* icons of this run go first, the rest is dropped if it doesn't fit */
+	int pass;
+	for (pass = 0; pass < 2; ++pass) {
+		for (i = 0; i < entries_n; ++i) {
+			if (!entries[i].used == !pass)
+				continue;
+			if (n == ICON_CACHE_MAX_ENTRIES)
+				break;
+			struct icon_cache_entry tmp = entries[i];
+			entries[i] = entries[n];
+			entries[n++] = tmp;
+		}
+	}
+
+	h.magic = ICON_CACHE_MAGIC;
+	h.version = ICON_CACHE_VERSION;
+	h.byte_order = ICON_CACHE_BYTE_ORDER;
+	h.entries_n = n;
+	if (fwrite(&h, sizeof(h), 1, f) != 1)
+		return -1;
+
+	uint32_t offset = sizeof(h) + n * sizeof(struct icon_cache_record);
+	for (i = 0; i < n; ++i) {
+		struct icon_cache_record r;
+		CLEAR_STRUCT(&r);
+		r.key = entries[i].key;
+		r.offset = offset;
+		if (fwrite(&r, sizeof(r), 1, f) != 1)
+			return -1;
+		offset += (uint32_t)r.key.width * r.key.height * 4;
+	}
+
+	for (i = 0; i < n; ++i) {
+		size_t len = (size_t)entries[i].key.width * entries[i].key.height;
+		if (fwrite(entries[i].pixels, 4, len, f) != len)
+			return -1;
+	}
+	return 0;
+}
+
+static void save_icon_cache()
+{
+	if (!dirty || !cache_path)
+		return;
+
+	/* $XDG_CACHE_HOME/bmpanel2 */
+	char *dir = xstrdup(cache_path);
+	*strrchr(dir, '/') = '\0';
+	char *parent = xstrdup(dir);
+	*strrchr(parent, '/') = '\0';
+	mkdir(parent, 0700);
+	mkdir(dir, 0700);
+	xfree(parent);
+	xfree(dir);
+
+	char *tmp_path = get_cache_path(".tmp");
+	FILE *f = fopen(tmp_path, "wb");
+	if (!f) {
+		XWARNING("Failed to write icon cache: \"%s\": %s", tmp_path,
+			 strerror(errno));
+		xfree(tmp_path);
+		return;
+	}
+
+	int failed = write_pack(f);
+	if (fclose(f) != 0)
+		failed = 1;
+	if (failed || rename(tmp_path, cache_path) != 0) {
+		XWARNING("Failed to write icon cache: \"%s\"", cache_path);
+		unlink(tmp_path);
+	}
+	xfree(tmp_path);
+}
+
+void free_icon_cache()
+{
+	size_t i;
+
+	save_icon_cache();
+	for (i = 0; i < entries_n; ++i) {
+		if (entries[i].owned)
+			xfree((void*)entries[i].pixels);
+	}
+	FREE_ARRAY(entries);
+	if (map)
+		munmap(map, map_size);
+	map = 0;
+	if (cache_path)
+		xfree(cache_path);
+	cache_path = 0;
+}
+
+static struct icon_cache_entry *find_entry(const struct icon_cache_key *key)
+{
+	size_t i;
+	for (i = 0; i < entries_n; ++i) {
+		if (memcmp(&entries[i].key, key, sizeof(*key)) == 0)
+			return &entries[i];
+	}
+	return 0;
+}
+
+cairo_surface_t *find_cached_icon(const struct icon_cache_key *key)
+{
+	struct icon_cache_entry *e = find_entry(key);
+	if (!e)
+		return 0;
+
+	int w = e->key.width;
+	int h = e->key.height;
+	cairo_surface_t *icon = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+							   w, h);
+	if (cairo_surface_status(icon) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(icon);
+		return 0;
+	}
+
+	cairo_surface_flush(icon);
+	unsigned char *data = cairo_image_surface_get_data(icon);
+	int stride = cairo_image_surface_get_stride(icon);
+	int y;
+	for (y = 0; y < h; ++y)
+		memcpy(data + y * stride, e->pixels + y * w, w * 4);
+	cairo_surface_mark_dirty(icon);
+
+	e->used = 1;
+	return icon;
+}
+
+void add_cached_icon(const struct icon_cache_key *key, cairo_surface_t *icon)
+{
+	int w = cairo_image_surface_get_width(icon);
+	int h = cairo_image_surface_get_height(icon);
+	if (w != key->width || h != key->height ||
+	    cairo_image_surface_get_format(icon) != CAIRO_FORMAT_ARGB32)
+		return;
+
+	struct icon_cache_entry *e = find_entry(key);
+	if (!e) {
+		struct icon_cache_entry ne;
+		CLEAR_STRUCT(&ne);
+		ne.key = *key;
+		ARRAY_APPEND(entries, ne);
+		e = &entries[entries_n - 1];
+	} else if (e->owned) {
+		xfree((void*)e->pixels);
+	}
+
+	cairo_surface_flush(icon);
+	const unsigned char *data = cairo_image_surface_get_data(icon);
+	int stride = cairo_image_surface_get_stride(icon);
+	uint32_t *pixels = xmalloc((size_t)w * h * 4);
+	int y;
+	for (y = 0; y < h; ++y)
+		memcpy(pixels + y * w, data + y * stride, w * 4);
+
+	e->pixels = pixels;
+	e->owned = 1;
+	e->used = 1;
+	dirty = 1;
+}
@@ -1,4 +1,7 @@
-#include "gui.h"
+#define XMALLOC_SOURCE msrc_image_cache
+#include <strings.h>
+#include "widget-utils.h"
+#include "array.h"
 
 #define IMAGES_CACHE_SIZE 128
 
@@ -10,20 +13,33 @@ struct image {
 static size_t images_cache_n;
 static struct image *images_cache[IMAGES_CACHE_SIZE];
 
-static struct image *load_image_from_file(const char *path)
+/* thread safe, it doesn't touch xmalloc'ed memory */
+static cairo_surface_t *decode_png(const char *path)
 {
 	cairo_surface_t *surface = cairo_image_surface_create_from_png(path);
 	if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
 		cairo_surface_destroy(surface);
 		return 0;
 	}
+	return surface;
+}
 
+static struct image *create_image(const char *path, cairo_surface_t *surface)
+{
 	struct image *img = xmalloc(sizeof(struct image));
 	img->filename = xstrdup(path);
 	img->surface = surface;
 	return img;
 }
 
+static struct image *load_image_from_file(const char *path)
+{
+	cairo_surface_t *surface = decode_png(path);
+	if (!surface)
+		return 0;
+	return create_image(path, surface);
+}
+
 static struct image *find_image_in_cache(const char *path)
 {
 	size_t i;
@@ -96,3 +112,100 @@ void clean_image_cache(int final)
 		free_image(images_cache[i], final);
 	images_cache_n = 0;
 }
+
+/**************************************************************************
+  Prefetching
+**************************************************************************/
+
+struct prefetch_job {
+	char *path;
+	cairo_surface_t *surface;
+};
+
+static void decode_job(gpointer data, gpointer user_data)
+{
+	struct prefetch_job *job = data;
+	job->surface = decode_png(job->path);
+}
+
+static int is_png_file_name(const char *value)
+{
+	size_t len = strlen(value);
+	return len > 4 && strcasecmp(value + len - 4, ".png") == 0;
+}
+
+struct prefetch {
+	/* array */
+	struct prefetch_job *jobs;
+	size_t jobs_n;
+	size_t jobs_alloc;
+};
+
+static void collect_image_paths(struct prefetch *pf, const char *dir,
+				struct config_format_entry *e)
+{
+	size_t i;
+
+	/* lazy states are decoded on first use */
+	if (e->name && is_lazy_theme_state(e->name))
+		return;
+
+	if (e->value && is_png_file_name(e->value)) {
+		char *path = xmalloc(strlen(dir) + 1 + strlen(e->value) + 1);
+		if (!strcmp(dir, ""))
+			strcpy(path, e->value);
+		else
+			sprintf(path, "%s/%s", dir, e->value);
+
+		for (i = 0; i < pf->jobs_n; ++i) {
+			if (!strcmp(pf->jobs[i].path, path))
+				break;
+		}
+		if (i != pf->jobs_n || find_image_in_cache(path)) {
+			xfree(path);
+		} else {
+			struct prefetch_job job = {path, 0};
+			ARRAY_APPEND(pf->jobs, job);
+		}
+	}
+
+	for (i = 0; i < e->children_n; ++i)
+		collect_image_paths(pf, dir, &e->children[i]);
+}
+
+void prefetch_images(struct config_format_tree *tree)
+{
+	struct prefetch pf;
+	size_t i;
+
+	INIT_EMPTY_ARRAY(pf.jobs);
+	collect_image_paths(&pf, tree->dir, &tree->root);
+
+	/* not worth it, images will be loaded on demand */
+	int threads = g_get_num_processors();
+	if (pf.jobs_n < 2 || threads < 2)
+		goto out;
+
+	GThreadPool *pool = g_thread_pool_new(decode_job, 0, threads, TRUE, 0);
+	if (!pool)
+		goto out;
+	for (i = 0; i < pf.jobs_n; ++i)
+		g_thread_pool_push(pool, &pf.jobs[i], 0);
+	/* waits for all jobs */
+	g_thread_pool_free(pool, FALSE, TRUE);
+
+	for (i = 0; i < pf.jobs_n; ++i) {
+		struct prefetch_job *job = &pf.jobs[i];
+		if (!job->surface)
+			continue;
+		if (images_cache_n == IMAGES_CACHE_SIZE) {
+			cairo_surface_destroy(job->surface);
+			continue;
+		}
+		try_add_image_to_cache(create_image(job->path, job->surface));
+	}
+out:
+	for (i = 0; i < pf.jobs_n; ++i)
+		xfree(pf.jobs[i].path);
+	FREE_ARRAY(pf.jobs);
+}
@@ -10,6 +10,50 @@ struct memory_source msrc_default = MEMSRC(
 	MEMSRC_NO_FLAGS
 );
 
+struct memory_source msrc_taskbar = MEMSRC("Taskbar", 0, 0, 0);
+struct memory_source msrc_pager = MEMSRC("Pager", 0, 0, 0);
+struct memory_source msrc_image_cache = MEMSRC("Image cache", 0, 0, 0);
+struct memory_source msrc_icons = MEMSRC("Window icons", 0, 0, 0);
+struct memory_source msrc_config = MEMSRC("Config parser", 0, 0, 0);
+struct memory_source msrc_text = MEMSRC("Text buffers", 0, 0, 0);
+
+struct memory_source *msrc_subsystems[] = {
+	&msrc_taskbar,
+	&msrc_pager,
+	&msrc_image_cache,
+	&msrc_icons,
+	&msrc_config,
+	&msrc_text
+};
+
+const size_t msrc_subsystems_n = sizeof(msrc_subsystems) /
+				 sizeof(msrc_subsystems[0]);
+
+/* time of the previous report (or the first allocation) */
+static time_t reported_time;
+
+static inline void account_alloc(struct memory_source *src, size_t size)
+{
+	src->allocs++;
+	src->bytes += size;
+	if (src->bytes > src->peak_bytes)
+		src->peak_bytes = src->bytes;
+	if (!reported_time)
+		reported_time = time(0);
+}
+
+static inline void account_free(struct memory_source *src, size_t size)
+{
+	src->frees++;
+	src->bytes -= size;
+}
+
+/* custom allocators have no realloc, the block is copied */
+static int can_realloc(struct memory_source *src)
+{
+	return !src->malloc && !src->free;
+}
+
 /**************************************************************************
   No debug
 **************************************************************************/
@@ -31,7 +75,12 @@ void *impl_xmalloc(size_t size, struct memory_source *src)
 	if (!ret)
 		XDIE("Out of memory, xmalloc failed.");
 
-	return ret;
+	struct memory_stat *stat = (struct memory_stat*)ret;
+	stat->src = src;
+	stat->size = size;
+	account_alloc(src, size);
+
+	return stat + 1;
 }
 
 void *impl_xmallocz(size_t size, struct memory_source *src)
@@ -43,10 +92,21 @@ void *impl_xmallocz(size_t size, struct memory_source *src)
 
 void impl_xfree(void *ptr, struct memory_source *src)
 {
-	if (src->free)
+	if (src->free && (src->flags & MEMSRC_RETURN_IMMEDIATELY)) {
 		(*src->free)(ptr, src);
+		return;
+	}
+
+	struct memory_stat *memstat = (struct memory_stat*)ptr - 1;
+
+	/* it may be released by another subsystem */
+	src = memstat->src;
+	account_free(src, memstat->size);
+
+	if (src->free)
+		(*src->free)(memstat, src);
 	else
-		free(ptr);
+		free(memstat);
 }
 
 char *impl_xstrdup(const char *str, struct memory_source *src)
@@ -55,6 +115,32 @@ char *impl_xstrdup(const char *str, struct memory_source *src)
 	char *ret = impl_xmalloc(len+1, src);
 	return strcpy(ret, str);
 }
+
+void *impl_xrealloc(void *ptr, size_t size, struct memory_source *src)
+{
+	if (!ptr)
+		return impl_xmalloc(size, src);
+
+	struct memory_stat *memstat = (struct memory_stat*)ptr - 1;
+	src = memstat->src;
+
+	if (!can_realloc(src)) {
+		void *ret = impl_xmalloc(size, src);
+		memcpy(ret, ptr, size < memstat->size ? size : memstat->size);
+		impl_xfree(ptr, src);
+		return ret;
+	}
+
+	account_free(src, memstat->size);
+	memstat = realloc(memstat, size + MEMDEBUG_OVERHEAD);
+	if (!memstat)
+		XDIE("Out of memory, xrealloc failed.");
+
+	memstat->size = size;
+	account_alloc(src, size);
+
+	return memstat + 1;
+}
 #else
 /**************************************************************************
   Memory debug
@@ -77,6 +163,7 @@ void *impl_xmalloc(size_t size, struct memory_source *src, const char *file, uns
 		XDIE("Out of memory, xmalloc(z) failed.");
 
 	struct memory_stat *stat = (struct memory_stat*)ret;
+	stat->src = src;
 	stat->file = file;
 	stat->line = line;
 	stat->size = size;
@@ -90,11 +177,9 @@ void *impl_xmalloc(size_t size, struct memory_source *src, const char *file, uns
 		src->stat_list->prev = stat;
 		src->stat_list = stat;
 	}
-	src->allocs++;
-	src->bytes += size;
+	account_alloc(src, size);
 
-	ret += sizeof(struct memory_stat);
-	return ret;
+	return stat + 1;
 }
 
 void *impl_xmallocz(size_t size, struct memory_source *src, const char *file, unsigned int line)
@@ -111,7 +196,10 @@ void impl_xfree(void *ptr, struct memory_source *src)
 		return;
 	}
 
-	struct memory_stat *memstat = ptr - sizeof(struct memory_stat);
+	struct memory_stat *memstat = (struct memory_stat*)ptr - 1;
+
+	/* it may be released by another subsystem */
+	src = memstat->src;
 
 	if (memstat->next)
 		memstat->next->prev = (memstat->prev) ? memstat->prev : 0;
@@ -120,8 +208,7 @@ void impl_xfree(void *ptr, struct memory_source *src)
 	if (src->stat_list == memstat)
 		src->stat_list = memstat->next;
 
-	src->frees++;
-	src->bytes -= memstat->size;
+	account_free(src, memstat->size);
 
 	if (src->free)
 		(*src->free)(memstat, src);
@@ -135,11 +222,55 @@ char *impl_xstrdup(const char *str, struct memory_source *src, const char *file,
 	char *ret = impl_xmalloc(len+1, src, file, line);
 	return strcpy(ret, str);
 }
+
+void *impl_xrealloc(void *ptr, size_t size, struct memory_source *src, const char *file, unsigned int line)
+{
+	if (!ptr)
+		return impl_xmalloc(size, src, file, line);
+
+	struct memory_stat *memstat = (struct memory_stat*)ptr - 1;
+	src = memstat->src;
+
+	if (!can_realloc(src)) {
+		void *ret = impl_xmalloc(size, src, file, line);
+		memcpy(ret, ptr, size < memstat->size ? size : memstat->size);
+		impl_xfree(ptr, src);
+		return ret;
+	}
+
+	/* the block may move, unlink it first */
+	if (memstat->next)
+		memstat->next->prev = memstat->prev;
+	if (memstat->prev)
+		memstat->prev->next = memstat->next;
+	if (src->stat_list == memstat)
+		src->stat_list = memstat->next;
+
+	account_free(src, memstat->size);
+	memstat = realloc(memstat, size + MEMDEBUG_OVERHEAD);
+	if (!memstat)
+		XDIE("Out of memory, xrealloc failed.");
+
+	memstat->file = file;
+	memstat->line = line;
+	memstat->size = size;
+	memstat->prev = 0;
+	memstat->next = src->stat_list;
+	if (src->stat_list)
+		src->stat_list->prev = memstat;
+	src->stat_list = memstat;
+	account_alloc(src, size);
+
+	return memstat + 1;
+}
+#endif /* #ifdef else NDEBUG */
+
 /**************************************************************************
-  Debug report utils
+  Report utils
 **************************************************************************/
 #ifndef MEMDEBUG_ASCII_STATS
-static void print_source_stat(struct memory_source *src, int details)
+static void print_source_stat(struct memory_source *src, unsigned int rate,
+			      int details)
 {
 	int diff = (int)src->allocs - src->frees;
 
@@ -149,11 +280,12 @@ static void print_source_stat(struct memory_source *src, int details)
 	printf("┃ Allocs:      %-58u ┃\n", src->allocs);
 	printf("┃ Frees:       %-58u ┃\n", src->frees);
 	printf("┃ Diff:        %-58d ┃\n", diff);
-	printf("┃ Bytes taken: %-58u ┃\n", src->bytes);
+	printf("┃ Allocs/s:    %-58u ┃\n", rate);
+	printf("┃ Bytes taken: %-58zu ┃\n", src->bytes);
 	printf("┃  + overhead: %-58d ┃\n", diff * (int)MEMDEBUG_OVERHEAD);
-	if (!diff || !src->stat_list || !details) {
-		printf("┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛\n");
-	} else {
+	printf("┃ Peak bytes:  %-58zu ┃\n", src->peak_bytes);
+#ifndef NDEBUG
+	if (diff && src->stat_list && details) {
 		printf("┠────────────┬────────────┬───────────────────────────────────────────────┨\n");
 		printf("┃     ptr    │    size    │                   location                    ┃\n");
 		printf("┠────────────┼────────────┼───────────────────────────────────────────────┨\n");
@@ -167,10 +299,14 @@ static void print_source_stat(struct memory_source *src, int details)
 			stat = stat->next;
 		}
 		printf("┗━━━━━━━━━━━━┷━━━━━━━━━━━━┷━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛\n");
+		return;
 	}
+#endif
+	printf("┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛\n");
 }
 #else
-static void print_source_stat(struct memory_source *src, int details)
+static void print_source_stat(struct memory_source *src, unsigned int rate,
+			      int details)
 {
 	int diff = (int)src->allocs - src->frees;
 
@@ -180,11 +316,12 @@ static void print_source_stat(struct memory_source *src, int details)
 	printf("| Allocs:      %-58u |\n", src->allocs);
 	printf("| Frees:       %-58u |\n", src->frees);
 	printf("| Diff:        %-58d |\n", diff);
-	printf("| Bytes taken: %-58u |\n", src->bytes);
-	printf("|  + overhead: %-58d |\n", diff * MEMDEBUG_OVERHEAD);
-	if (!diff || !src->stat_list || !details) {
-		printf("\\=========================================================================/\n");
-	} else {
+	printf("| Allocs/s:    %-58u |\n", rate);
+	printf("| Bytes taken: %-58zu |\n", src->bytes);
+	printf("|  + overhead: %-58d |\n", diff * (int)MEMDEBUG_OVERHEAD);
+	printf("| Peak bytes:  %-58zu |\n", src->peak_bytes);
+#ifndef NDEBUG
+	if (diff && src->stat_list && details) {
 		printf("+------------+------------+-----------------------------------------------+\n");
 		printf("|     ptr    |    size    |                   location                    |\n");
 		printf("+------------+------------+-----------------------------------------------+\n");
@@ -193,23 +330,35 @@ static void print_source_stat(struct memory_source *src, int details)
 			char location[50];
 			snprintf(location, sizeof(location), "%s:%u", stat->file, stat->line);
 			location[sizeof(location)-1] = '\0';
-			printf("| %10p | %10u | %-45s |\n", stat+1, stat->size,
+			printf("| %10p | %10zu | %-45s |\n", stat+1, stat->size,
 				location);
 			stat = stat->next;
 		}
 		printf("\\============+============+===============================================/\n");
+		return;
 	}
+#endif
+	printf("\\=========================================================================/\n");
 }
 #endif /* #ifndef else MEMDEBUG_ASCII_STATS */
-#endif /* #ifdef else NDEBUG */
+
+static unsigned int take_rate(struct memory_source *src, time_t elapsed)
+{
+	unsigned int rate = (src->allocs - src->reported_allocs) / elapsed;
+	src->reported_allocs = src->allocs;
+	return rate;
+}
 
 void xmemstat(struct memory_source **sources, size_t n, int details)
 {
-#ifndef NDEBUG
 	size_t i;
+	time_t now = time(0);
+	time_t elapsed = reported_time && now > reported_time ?
+		now - reported_time : 1;
 
 	printf("\033[32m");
-	print_source_stat(&msrc_default, details);
+	print_source_stat(&msrc_default, take_rate(&msrc_default, elapsed),
+			  details);
 
 	for (i = 0; i < n; ++i) {
 		if (i % 2)
@@ -217,9 +366,10 @@ void xmemstat(struct memory_source **sources, size_t n, int details)
 		else
 			printf("\033[0m");
 
-		print_source_stat(sources[i], details);
+		print_source_stat(sources[i], take_rate(sources[i], elapsed),
+				  details);
 	}
 	printf("\033[0m");
 	fflush(stdout);
-#endif
+	reported_time = now;
 }
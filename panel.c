@@ -337,6 +337,7 @@ static void parse_panel_widgets(struct panel *panel, struct config_format_tree *
 		w->interface = we;
 		w->panel = panel;
 		w->needs_expose = 0;
+		w->tick_deadline = 0;
 
 		if ((*we->create_widget_private)(w, e, tree) == 0) {
 			panel->widgets_n++;
@@ -377,6 +378,7 @@ static void retheme_reconfigure_panel_widgets(struct widget_stash *stash,
 		w->interface = we;
 		w->panel = panel;
 		w->needs_expose = 0;
+		w->tick_deadline = 0;
 
 		int stashwi = find_widget_in_stash(e->name, stash);
 		if (stashwi != -1 && we->retheme_reconfigure) {
@@ -472,10 +474,108 @@ void recalculate_widgets_sizes(struct panel *panel)
 	panel->widgets[i].x = x;
 	panel->widgets[i].width = x2 - x;
 
+	/* rebuild hit-testing table, widgets are placed from left to right */
+	panel->widget_spans_n = 0;
+	for (i = 0; i < panel->widgets_n; ++i) {
+		struct widget *w = &panel->widgets[i];
+		if (!w->width)
+			continue;
+		struct span *s = &panel->widget_spans[panel->widget_spans_n++];
+		s->x = w->x;
+		s->w = w->width;
+		s->index = (int)i;
+	}
+
 	/* request redraw */
 	panel->needs_expose = 1;
 }
 
+struct widget *find_widget_at(struct panel *panel, int x, int y)
+{
+	if (y < 0 || y >= panel->height)
+		return 0;
+
+	int i = find_span(panel->widget_spans, panel->widget_spans_n, x);
+	if (i == -1)
+		return 0;
+	return &panel->widgets[i];
+}
+
+/**************************************************************************
+  Timers
+**************************************************************************/
+
+static gboolean panel_timer(gpointer data);
+
+int64_t get_time_ms()
+{
+	return g_get_monotonic_time() / 1000;
+}
+
+static void rearm_panel_timer(struct panel *p)
+{
+	int64_t deadline = 0;
+	size_t i;
+	for (i = 0; i < p->widgets_n; ++i) {
+		struct widget *w = &p->widgets[i];
+		if (w->tick_deadline && (!deadline || w->tick_deadline < deadline))
+			deadline = w->tick_deadline;
+	}
+
+	if (p->timer && deadline == p->timer_deadline)
+		return;
+
+	if (p->timer)
+		g_source_remove(p->timer);
+	p->timer = 0;
+	p->timer_deadline = deadline;
+	if (!deadline)
+		return;
+
+	int64_t delay = deadline - get_time_ms();
+	if (delay < 0)
+		delay = 0;
+
+	if (delay >= 1000)
+		p->timer = g_timeout_add_seconds((delay + 999) / 1000,
+						 panel_timer, p);
+	else
+		p->timer = g_timeout_add(delay, panel_timer, p);
+}
+
+static void stop_panel_timer(struct panel *p)
+{
+	if (p->timer)
+		g_source_remove(p->timer);
+	p->timer = 0;
+	p->timer_deadline = 0;
+}
+
+void schedule_widget_tick(struct widget *w, int64_t deadline)
+{
+	if (w->tick_deadline && w->tick_deadline <= deadline)
+		return;
+
+	w->tick_deadline = deadline;
+	if (!w->panel->ticking)
+		rearm_panel_timer(w->panel);
+}
+
+/**************************************************************************
+  Exposing
+**************************************************************************/
+
+/* the frame is on the screen, let widgets send their deferred requests */
+static void expose_done(struct panel *panel)
+{
+	size_t i;
+	for (i = 0; i < panel->widgets_n; ++i) {
+		struct widget *wi = &panel->widgets[i];
+		if (wi->interface->expose_done)
+			(*wi->interface->expose_done)(wi);
+	}
+}
+
 static void expose_whole_panel(struct panel *panel)
 {
 	Display *dpy = panel->connection.dpy;
@@ -510,6 +610,7 @@ static void expose_whole_panel(struct panel *panel)
 
 		/* widget was drawn, clear "needs_expose" flag */
 		wi->needs_expose = 0;
+		wi->needs_partial_expose = 0;
 	}
 
 	(*panel->render->blit)(panel, 0, 0, panel->width, panel->height);
@@ -524,6 +625,7 @@ static void expose_whole_panel(struct panel *panel)
 		if (wi->interface->panel_exposed)
 			(*wi->interface->panel_exposed)(wi);
 	}
+	expose_done(panel);
 	XFlush(dpy);
 }
 
@@ -539,7 +641,14 @@ static void expose_panel(struct panel *panel)
 	size_t i;
 	for (i = 0; i < panel->widgets_n; ++i) {
 		struct widget *w = &panel->widgets[i];
-		if (!w->needs_expose)
+		if (!w->needs_expose && w->needs_partial_expose &&
+		    w->interface->partial_draw)
+		{
+			w->needs_partial_expose = 0;
+			(*w->interface->partial_draw)(w);
+			continue;
+		}
+		if (!w->needs_expose && !w->needs_partial_expose)
 			continue;
 
 		pattern_image(panel->theme.background, panel->cr,
@@ -554,10 +663,37 @@ static void expose_panel(struct panel *panel)
 		(*panel->render->blit)(panel, w->x, 0,
 				       w->width, panel->height);
 		w->needs_expose = 0;
+		w->needs_partial_expose = 0;
 	}
+	expose_done(panel);
 	XFlush(dpy);
 }
 
+void begin_partial_expose(struct widget *w, int x, int width)
+{
+	struct panel *panel = w->panel;
+
+	pattern_image(panel->theme.background, panel->cr, x, 0, width, 0);
+	cairo_save(panel->cr);
+	cairo_rectangle(panel->cr, x, 0, width, panel->height);
+	cairo_clip(panel->cr);
+	if (w->paint_replace)
+		cairo_set_operator(panel->cr, CAIRO_OPERATOR_SOURCE);
+}
+
+void end_partial_expose(struct widget *w, int x, int width)
+{
+	struct panel *panel = w->panel;
+
+	cairo_restore(panel->cr);
+	(*panel->render->blit)(panel, x, 0, width, panel->height);
+}
+
+static void panel_client_change(void *data, unsigned int change, Window win)
+{
+	disp_client_change((struct panel*)data, change, win);
+}
+
 void init_panel(struct panel *panel, struct config_format_tree *tree,
 		int monitor)
 {
@@ -565,6 +701,8 @@ void init_panel(struct panel *panel, struct config_format_tree *tree,
 
 	/* connect to X server */
 	x_connect(&panel->connection, 0);
+	ewmh_clients_init(&panel->clients, &panel->connection,
+			  panel_client_change, panel);
 
 	/* parse panel theme */
 	if (load_panel_theme(&panel->theme, tree))
@@ -590,6 +728,7 @@ void init_panel(struct panel *panel, struct config_format_tree *tree,
 
 	/* parse panel widgets */
 	parse_panel_widgets(panel, tree);
+	rebuild_event_routes(panel);
 	recalculate_widgets_sizes(panel);
 
 	/* all ok, map window */
@@ -606,6 +745,7 @@ void free_panel(struct panel *panel)
 {
 	size_t i;
 
+	stop_panel_timer(panel);
 	if (panel->render->free_private)
 		(*panel->render->free_private)(panel);
 
@@ -614,18 +754,21 @@ void free_panel(struct panel *panel)
 		(*w->interface->destroy_widget_private)(w);
 	}
 	panel->widgets_n = 0;
+	free_event_routes(panel);
 
 	g_object_unref(panel->layout);
 	cairo_destroy(panel->cr);
 	XDestroyWindow(panel->connection.dpy, panel->win);
 	XFreePixmap(panel->connection.dpy, panel->bg);
 	free_panel_theme(&panel->theme);
+	ewmh_clients_free(&panel->clients);
 	x_disconnect(&panel->connection);
 }
 
 void reconfigure_free_panel(struct panel *panel, struct widget_stash *stash)
 {
 	/* free stuff */
+	stop_panel_timer(panel);
 	if (panel->render->free_private)
 		(*panel->render->free_private)(panel);
 
@@ -671,6 +814,7 @@ void reconfigure_panel(struct panel *panel, struct config_format_tree *tree,
 
 	XFreePixmap(panel->connection.dpy, panel->bg);
 	panel->bg = x_create_default_pixmap(c, w, h);
+	panel->bg_generation++;
 
 	/* render private */
 	if (panel->render->create_private)
@@ -690,7 +834,9 @@ void reconfigure_panel(struct panel *panel, struct config_format_tree *tree,
 		(*w->interface->destroy_widget_private)(w);
 	}
 	xfree(stash->widgets);
+	rebuild_event_routes(panel);
 	recalculate_widgets_sizes(panel);
+	rearm_panel_timer(panel);
 
 	/* all ok, update window */
 	XSetWindowBackgroundPixmap(c->dpy, panel->win, panel->bg);
@@ -751,10 +897,12 @@ static void panel_button_press_release(struct panel *p, XButtonEvent *e)
 
 static void panel_property_notify(struct panel *p, XPropertyEvent *e)
 {
+	x_window_prop_changed(&p->connection, e->window, e->atom);
 	if (e->atom == p->connection.atoms[XATOM_XROOTPMAP_ID]) {
 		x_update_root_pmap(&p->connection);
 		if (p->render->update_bg)
 			(*p->render->update_bg)(p);
+		p->bg_generation++;
 	}
 }
 
@@ -801,6 +949,7 @@ static void panel_configure_notify(struct panel *p, XConfigureEvent *e)
 
 		if (p->render->panel_resize)
 			(*p->render->panel_resize)(p);
+		p->bg_generation++;
 
 		recalculate_widgets_sizes(p);
 	}
@@ -829,7 +978,6 @@ static int process_events(struct panel *p)
 		case MapNotify:
 		case UnmapNotify:
 		case VisibilityNotify:
-		case ReparentNotify:
 		case SelectionClear:
 			/* skip? */
 			break;
@@ -845,6 +993,15 @@ static int process_events(struct panel *p)
 			break;
 
 		case MotionNotify:
+			/* only the latest position matters, skip the rest */
+			while (XEventsQueued(dpy, QueuedAlready)) {
+				XEvent next;
+				XPeekEvent(dpy, &next);
+				if (next.type != MotionNotify ||
+				    next.xmotion.window != e.xmotion.window)
+					break;
+				XNextEvent(dpy, &e);
+			}
 			disp_motion_notify(p, &e.xmotion);
 			break;
 
@@ -855,6 +1012,7 @@ static int process_events(struct panel *p)
 
 		case PropertyNotify:
 			panel_property_notify(p, &e.xproperty);
+			ewmh_clients_property_notify(&p->clients, &e.xproperty);
 			disp_property_notify(p, &e.xproperty);
 			break;
 
@@ -863,15 +1021,43 @@ static int process_events(struct panel *p)
 			break;
 
 		case ConfigureNotify:
+			/* only the latest geometry matters, a synthetic event
+			 * isn't merged with a real one, they have different
+			 * coordinates
+			 */
+			while (XEventsQueued(dpy, QueuedAlready)) {
+				XEvent next;
+				XPeekEvent(dpy, &next);
+				if (next.type != ConfigureNotify ||
+				    next.xconfigure.window != e.xconfigure.window ||
+				    next.xconfigure.send_event != e.xconfigure.send_event)
+					break;
+				XNextEvent(dpy, &e);
+			}
 			panel_configure_notify(p, &e.xconfigure);
+			ewmh_clients_configure_notify(&p->clients, &e.xconfigure);
 			disp_configure(p, &e.xconfigure);
 			break;
 
+		case ReparentNotify:
+			ewmh_clients_reparent_notify(&p->clients, &e.xreparent);
+			break;
+
 		case DestroyNotify:
+			x_window_destroyed(&p->connection, e.xdestroywindow.window);
 			disp_win_destroy(p, &e.xdestroywindow);
 			break;
 
 		default:
+#ifdef HAVE_COMPOSITE
+			if (p->connection.composite &&
+			    e.type == p->connection.damage_event_base + XDamageNotify)
+			{
+				XDamageNotifyEvent *de = (XDamageNotifyEvent*)&e;
+				disp_damage_notify(p, e.type, de->drawable);
+				break;
+			}
+#endif
 			/*XWARNING("Unknown XEvent (type: %d, win: %d)",
 				 e.type, e.xany.window);*/
 			break;
@@ -882,20 +1068,32 @@ static int process_events(struct panel *p)
 	return events_processed;
 }
 
-static gboolean panel_second_timeout(gpointer data)
+static gboolean panel_timer(gpointer data)
 {
 	struct panel *p = data;
+	int64_t now = get_time_ms();
 	size_t i;
 	struct widget *w;
+
+	p->timer = 0;
+	p->timer_deadline = 0;
+	p->ticking = 1;
 	for (i = 0; i < p->widgets_n; ++i) {
 		w = &p->widgets[i];
+		if (!w->tick_deadline || w->tick_deadline > now)
+			continue;
+		w->tick_deadline = 0;
 		if (w->interface->clock_tick)
 			(*w->interface->clock_tick)(w);
 	}
+	p->ticking = 0;
+
 	expose_panel(p);
-	/* just in case, actually it helps a lot */
-	process_events(p);
-	return 1;
+	/* exposing may do round trips which queue events */
+	while (process_events(p))
+		;
+	rearm_panel_timer(p);
+	return 0;
 }
 
 static gboolean panel_x_in(GIOChannel *gio, GIOCondition condition, gpointer data)
@@ -911,6 +1109,42 @@ static gboolean panel_x_in(GIOChannel *gio, GIOCondition condition, gpointer dat
 	return 1;
 }
 
+/* Events read into the Xlib queue during a round trip don't make the
+ * connection readable, this source dispatches them.
+ */
+struct x_queue_source {
+	GSource source;
+	struct panel *panel;
+};
+
+static gboolean x_queue_check(GSource *source)
+{
+	struct x_queue_source *xs = (struct x_queue_source*)source;
+	return QLength(xs->panel->connection.dpy) > 0;
+}
+
+static gboolean x_queue_prepare(GSource *source, gint *timeout)
+{
+	*timeout = -1;
+	return x_queue_check(source);
+}
+
+static gboolean x_queue_dispatch(GSource *source, GSourceFunc callback,
+				 gpointer data)
+{
+	struct x_queue_source *xs = (struct x_queue_source*)source;
+	while (process_events(xs->panel))
+		;
+	return 1;
+}
+
+static GSourceFuncs x_queue_funcs = {
+	x_queue_prepare,
+	x_queue_check,
+	x_queue_dispatch,
+	0
+};
+
 void panel_main_loop(struct panel *panel)
 {
 	int fd = ConnectionNumber(panel->connection.dpy);
@@ -920,7 +1154,12 @@ void panel_main_loop(struct panel *panel)
 	g_io_add_watch(x, G_IO_IN | G_IO_HUP, panel_x_in, panel);
 	g_io_channel_unref(x);
 
-	g_timeout_add(1000, panel_second_timeout, panel);
+	GSource *xq = g_source_new(&x_queue_funcs, sizeof(struct x_queue_source));
+	((struct x_queue_source*)xq)->panel = panel;
+	g_source_attach(xq, 0);
+	g_source_unref(xq);
+
+	rearm_panel_timer(panel);
 
 	g_main_loop_run(panel->loop);
 	g_main_loop_unref(panel->loop);
@@ -1,3 +1,4 @@
+#define XMALLOC_SOURCE msrc_text
 #include "util.h"
 
 /**************************************************************************
@@ -0,0 +1,336 @@
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "array.h"
+#include "config-parser.h"
+#include "xdg.h"
+#include "theme-index.h"
+
+/* The index is a text file, one theme per line:
+ *
+ *   bmpanel2 theme index 1
+ *   <themes dir>
+ *   <dir mtime> <dir mtime nsec>
+ *   <mtime> <mtime nsec>\t<shortname>\t<name>\t<author>
+ *
+ * Tabs and newlines in the values are replaced with spaces, an empty value
+ * means the one not specified.
+ */
+
+#define THEME_INDEX_HEADER "bmpanel2 theme index 1"
+
+static uint32_t hash_string(const char *s)
+{
+	uint32_t h = 2166136261u; /* FNV-1a */
+	for (; *s; ++s) {
+		h ^= (unsigned char)*s;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static char *get_index_path(const char *dir, const char *suffix)
+{
+	char *cache = get_XDG_CACHE_HOME();
+	if (!cache)
+		return 0;
+
+	char *path = xmalloc(strlen(cache) + sizeof("/bmpanel2/themes-01234567") +
+			     strlen(suffix));
+	sprintf(path, "%s/bmpanel2/themes-%08x%s", cache, hash_string(dir), suffix);
+	xfree(cache);
+	return path;
+}
+
+static void free_entry(struct theme_index_entry *e)
+{
+	xfree(e->shortname);
+	if (e->name)
+		xfree(e->name);
+	if (e->author)
+		xfree(e->author);
+}
+
+static char *dup_value(const char *value)
+{
+	if (!value || value[0] == '\0')
+		return 0;
+
+	char *ret = xstrdup(value);
+	char *c;
+	for (c = ret; *c; ++c) {
+		if (*c == '\t' || *c == '\n')
+			*c = ' ';
+	}
+	return ret;
+}
+
+static int parse_theme(struct theme_index_entry *e, const char *themefile)
+{
+	struct config_format_tree tree;
+	if (0 != load_config_format_tree(&tree, themefile))
+		return -1;
+
+	struct config_format_entry *te = find_config_format_entry(&tree.root,
+								  "theme");
+	if (te) {
+		e->name = dup_value(find_config_format_entry_value(te, "name"));
+		e->author = dup_value(find_config_format_entry_value(te, "author"));
+	}
+	free_config_format_tree(&tree);
+	return 0;
+}
+
+/* fills the entry, returns -1 if there is no readable theme */
+static int index_theme(struct theme_index_entry *e, const char *dir,
+		       const char *shortname)
+{
+	char buf[4096];
+	struct stat st;
+
+	snprintf(buf, sizeof(buf), "%s/%s/theme", dir, shortname);
+	buf[sizeof(buf)-1] = '\0';
+	if (stat(buf, &st) != 0 || !S_ISREG(st.st_mode))
+		return -1;
+
+	CLEAR_STRUCT(e);
+	if (parse_theme(e, buf) < 0)
+		return -1;
+	e->shortname = xstrdup(shortname);
+	e->mtime = st.st_mtime;
+	e->mtime_nsec = st.st_mtim.tv_nsec;
+	return 0;
+}
+
+/**************************************************************************
+  Index file
+**************************************************************************/
+
+/* returns the next tab separated field, modifies the line */
+static char *next_field(char **line)
+{
+	char *field = *line;
+	if (!field)
+		return 0;
+
+	char *end = strchr(field, '\t');
+	if (end) {
+		*end = '\0';
+		*line = end + 1;
+	} else {
+		*line = 0;
+	}
+	return field;
+}
+
+static int read_index(struct theme_index *ti, FILE *f, const struct stat *dirst)
+{
+	char *line = 0;
+	size_t line_alloc = 0;
+	ssize_t len;
+	int lineno = 0;
+	int ret = -1;
+
+	while ((len = getline(&line, &line_alloc, f)) != -1) {
+		if (len && line[len-1] == '\n')
+			line[len-1] = '\0';
+
+		switch (lineno++) {
+		case 0:
+			if (strcmp(line, THEME_INDEX_HEADER) != 0)
+				goto out;
+			continue;
+		case 1:
+			if (strcmp(line, ti->dir) != 0)
+				goto out;
+			continue;
+		case 2: {
+			long long sec;
+			long nsec;
+			if (sscanf(line, "%lld %ld", &sec, &nsec) != 2 ||
+			    (time_t)sec != dirst->st_mtime ||
+			    nsec != dirst->st_mtim.tv_nsec)
+				goto out;
+			continue;
+		}
+		default:
+			break;
+		}
+
+		struct theme_index_entry e;
+		long long sec;
+		char *rest = line;
+		char *mtime = next_field(&rest);
+		char *shortname = next_field(&rest);
+		char *name = next_field(&rest);
+		char *author = next_field(&rest);
+		if (!author || !shortname[0] ||
+		    sscanf(mtime, "%lld %ld", &sec, &e.mtime_nsec) != 2)
+			goto out;
+
+		e.mtime = (time_t)sec;
+		e.shortname = xstrdup(shortname);
+		e.name = dup_value(name);
+		e.author = dup_value(author);
+		ARRAY_APPEND(ti->entries, e);
+	}
+	if (lineno >= 3)
+		ret = 0;
+out:
+	if (line)
+		free(line);
+	return ret;
+}
+
+static int write_index(struct theme_index *ti, FILE *f, const struct stat *dirst)
+{
+	size_t i;
+
+	fprintf(f, THEME_INDEX_HEADER "\n%s\n%lld %ld\n", ti->dir,
+		(long long)dirst->st_mtime, (long)dirst->st_mtim.tv_nsec);
+	for (i = 0; i < ti->entries_n; ++i) {
+		struct theme_index_entry *e = &ti->entries[i];
+		fprintf(f, "%lld %ld\t%s\t%s\t%s\n", (long long)e->mtime,
+			e->mtime_nsec, e->shortname, e->name ? e->name : "",
+			e->author ? e->author : "");
+	}
+	return ferror(f) ? -1 : 0;
+}
+
+static void save_index(struct theme_index *ti, const struct stat *dirst)
+{
+	char *path = get_index_path(ti->dir, "");
+	if (!path)
+		return;
+
+	/* $XDG_CACHE_HOME/bmpanel2 */
+	char *dir = xstrdup(path);
+	*strrchr(dir, '/') = '\0';
+	char *parent = xstrdup(dir);
+	*strrchr(parent, '/') = '\0';
+	mkdir(parent, 0700);
+	mkdir(dir, 0700);
+	xfree(parent);
+	xfree(dir);
+
+	char *tmp_path = get_index_path(ti->dir, ".tmp");
+	FILE *f = fopen(tmp_path, "w");
+	if (!f) {
+		XWARNING("Failed to write theme index: \"%s\": %s", tmp_path,
+			 strerror(errno));
+		goto out;
+	}
+
+	int failed = write_index(ti, f, dirst);
+	if (fclose(f) != 0)
+		failed = 1;
+	if (failed || rename(tmp_path, path) != 0) {
+		XWARNING("Failed to write theme index: \"%s\"", path);
+		unlink(tmp_path);
+	}
+out:
+	xfree(tmp_path);
+	xfree(path);
+}
+
+/**************************************************************************
+  Interface
+**************************************************************************/
+
+static void clear_entries(struct theme_index *ti)
+{
+	size_t i;
+	for (i = 0; i < ti->entries_n; ++i)
+		free_entry(&ti->entries[i]);
+	CLEAR_ARRAY(ti->entries);
+}
+
+static void rebuild_index(struct theme_index *ti)
+{
+	DIR *d = opendir(ti->dir);
+	if (!d)
+		return;
+
+	struct dirent *de;
+	while ((de = readdir(d)) != 0) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+
+		struct theme_index_entry e;
+		if (index_theme(&e, ti->dir, de->d_name) == 0)
+			ARRAY_APPEND(ti->entries, e);
+	}
+	closedir(d);
+}
+
+/* returns true if something was changed */
+static int update_changed_themes(struct theme_index *ti)
+{
+	char buf[4096];
+	struct stat st;
+	int changed = 0;
+	size_t i;
+
+	for (i = 0; i < ti->entries_n; ++i) {
+		struct theme_index_entry *e = &ti->entries[i];
+		snprintf(buf, sizeof(buf), "%s/%s/theme", ti->dir, e->shortname);
+		buf[sizeof(buf)-1] = '\0';
+		if (stat(buf, &st) == 0 && st.st_mtime == e->mtime &&
+		    st.st_mtim.tv_nsec == e->mtime_nsec)
+			continue;
+
+		struct theme_index_entry ne;
+		int ok = index_theme(&ne, ti->dir, e->shortname) == 0;
+		free_entry(e);
+		if (ok) {
+			*e = ne;
+		} else {
+			ARRAY_REMOVE(ti->entries, i);
+			i--;
+		}
+		changed = 1;
+	}
+	return changed;
+}
+
+int load_theme_index(struct theme_index *ti, const char *dir, int check_themes)
+{
+	struct stat st;
+
+	ti->dir = xstrdup(dir);
+	INIT_EMPTY_ARRAY(ti->entries);
+	if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode))
+		return -1;
+
+	int valid = 0;
+	char *path = get_index_path(dir, "");
+	if (path) {
+		FILE *f = fopen(path, "r");
+		if (f) {
+			valid = read_index(ti, f, &st) == 0;
+			fclose(f);
+		}
+		xfree(path);
+	}
+
+	int dirty = 0;
+	if (!valid) {
+		clear_entries(ti);
+		rebuild_index(ti);
+		dirty = 1;
+	} else if (check_themes) {
+		dirty = update_changed_themes(ti);
+	}
+
+	if (dirty)
+		save_index(ti, &st);
+	return 0;
+}
+
+void free_theme_index(struct theme_index *ti)
+{
+	clear_entries(ti);
+	FREE_ARRAY(ti->entries);
+	xfree(ti->dir);
+}
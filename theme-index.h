@@ -0,0 +1,37 @@
+#pragma once
+
+#include <time.h>
+#include "util.h"
+
+/* Theme index: names and authors of the themes in a themes directory, kept
+ * in $XDG_CACHE_HOME/bmpanel2 so that listing themes doesn't parse every
+ * theme file. The index is valid while the directory mtime is the same.
+ */
+
+struct theme_index_entry {
+	char *shortname; /* directory name */
+	char *name; /* zero if not specified */
+	char *author; /* zero if not specified */
+
+	/* mtime of the theme file */
+	time_t mtime;
+	long mtime_nsec;
+};
+
+struct theme_index {
+	char *dir;
+
+	/* array, in readdir order */
+	struct theme_index_entry *entries;
+	size_t entries_n;
+	size_t entries_alloc;
+};
+
+/* Loads an index of the "dir" or rebuilds it if it's stale. With
+ * "check_themes" each theme file is checked for changes as well.
+ *
+ * Returns -1 if there is no such directory, the index should be released
+ * using free_theme_index anyway.
+ */
+int load_theme_index(struct theme_index *ti, const char *dir, int check_themes);
+void free_theme_index(struct theme_index *ti);
@@ -71,7 +71,7 @@ const char *pretty_print_FILE(const char *file);
 
 /* Memory source helper macro */
 #define MEMSRC(name, malloc, free, flags) \
-	{name, 0, 0, 0, 0, (malloc), (free), (flags)}
+	{name, 0, 0, 0, 0, 0, 0, (malloc), (free), (flags)}
 
 /* Defaults for convenience. */
 #define MEMSRC_DEFAULT_MALLOC (0)
@@ -87,20 +87,41 @@ const char *pretty_print_FILE(const char *file);
  */
 #define MEMSRC_RETURN_IMMEDIATELY (1 << 0)
 
+struct memory_source;
+
+/*
+ * Every allocation is prefixed by a header, which keeps the source it was
+ * taken from. So the counters are right no matter where the memory is
+ * released.
+ */
+#ifdef NDEBUG
+struct memory_stat {
+	struct memory_source *src;
+	size_t size;
+};
+#else
 struct memory_stat {
 	struct memory_stat *next;
 	struct memory_stat *prev;
+	struct memory_source *src;
 	const char *file;
 	unsigned int line;
 	size_t size;
 };
+#endif
 
 struct memory_source {
 	const char *name;
+
+	/* counters, maintained in release builds too */
 	unsigned int allocs;
 	unsigned int frees;
-	int bytes;
-	struct memory_stat *stat_list;
+	size_t bytes;
+	size_t peak_bytes;
+
+	/* state of the previous xmemstat call, for the rates */
+	unsigned int reported_allocs;
+	struct memory_stat *stat_list; /* debug builds only */
 
 	void *(*malloc)(size_t, struct memory_source*);
 	void (*free)(void*, struct memory_source*);
@@ -108,21 +129,37 @@ struct memory_source {
 	unsigned int flags;
 };
 
-/* overheads */
-#ifdef NDEBUG
-	#define MEMDEBUG_OVERHEAD (0)
-#else
-	#define MEMDEBUG_OVERHEAD (sizeof(struct memory_stat))
+#define MEMDEBUG_OVERHEAD (sizeof(struct memory_stat))
+
+/*
+ * Allocations of a translation unit are taken from XMALLOC_SOURCE. To account
+ * them to a subsystem source, define it before including anything:
+ *
+ *   #define XMALLOC_SOURCE msrc_pager
+ */
+#ifndef XMALLOC_SOURCE
+	#define XMALLOC_SOURCE msrc_default
 #endif
 
 extern struct memory_source msrc_default;
+extern struct memory_source msrc_taskbar;
+extern struct memory_source msrc_pager;
+extern struct memory_source msrc_image_cache;
+extern struct memory_source msrc_icons;
+extern struct memory_source msrc_config;
+extern struct memory_source msrc_text;
+
+/* all of the above except the default one, for xmemstat */
+extern struct memory_source *msrc_subsystems[];
+extern const size_t msrc_subsystems_n;
 
 /* functions */
 #ifdef NDEBUG
-	#define xmalloc(a)	impl_xmalloc((a), &msrc_default)
-	#define xmallocz(a)	impl_xmallocz((a), &msrc_default)
-	#define xfree(a)	impl_xfree((a), &msrc_default)
-	#define xstrdup(a)	impl_xstrdup((a), &msrc_default)
+	#define xmalloc(a)	impl_xmalloc((a), &XMALLOC_SOURCE)
+	#define xmallocz(a)	impl_xmallocz((a), &XMALLOC_SOURCE)
+	#define xfree(a)	impl_xfree((a), &XMALLOC_SOURCE)
+	#define xstrdup(a)	impl_xstrdup((a), &XMALLOC_SOURCE)
+	#define xrealloc(p, a)	impl_xrealloc((p), (a), &XMALLOC_SOURCE)
 
 	#define xmalloc_from_source(a, s)	impl_xmalloc((a), (s))
 	#define xmallocz_from_source(a, s)	impl_xmallocz((a), (s))
@@ -133,11 +170,13 @@ extern struct memory_source msrc_default;
 	void *impl_xmallocz(size_t size, struct memory_source *src);
 	void impl_xfree(void *ptr, struct memory_source *src);
 	char *impl_xstrdup(const char *str, struct memory_source *src);
+	void *impl_xrealloc(void *ptr, size_t size, struct memory_source *src);
 #else
-	#define xmalloc(a)	impl_xmalloc((a), &msrc_default, __FILE__, __LINE__)
-	#define xmallocz(a)	impl_xmallocz((a), &msrc_default, __FILE__, __LINE__)
-	#define xfree(a)	impl_xfree((a), &msrc_default)
-	#define xstrdup(a)	impl_xstrdup((a), &msrc_default, __FILE__, __LINE__)
+	#define xmalloc(a)	impl_xmalloc((a), &XMALLOC_SOURCE, __FILE__, __LINE__)
+	#define xmallocz(a)	impl_xmallocz((a), &XMALLOC_SOURCE, __FILE__, __LINE__)
+	#define xfree(a)	impl_xfree((a), &XMALLOC_SOURCE)
+	#define xstrdup(a)	impl_xstrdup((a), &XMALLOC_SOURCE, __FILE__, __LINE__)
+	#define xrealloc(p, a)	impl_xrealloc((p), (a), &XMALLOC_SOURCE, __FILE__, __LINE__)
 
 	#define xmalloc_from_source(a, s)	impl_xmalloc((a), (s), __FILE__, __LINE__)
 	#define xmallocz_from_source(a, s)	impl_xmallocz((a), (s), __FILE__, __LINE__)
@@ -148,11 +187,19 @@ extern struct memory_source msrc_default;
 	void *impl_xmallocz(size_t size, struct memory_source *src, const char *file, unsigned int line);
 	void impl_xfree(void *ptr, struct memory_source *src);
 	char *impl_xstrdup(const char *str, struct memory_source *src, const char *file, unsigned int line);
+	void *impl_xrealloc(void *ptr, size_t size, struct memory_source *src, const char *file, unsigned int line);
 #endif
 
+/*
+ * xrealloc keeps the memory in the source it was taken from ("src" is used
+ * only if "ptr" is zero). Sources with MEMSRC_RETURN_IMMEDIATELY flag are not
+ * supported.
+ */
+
 /* #define MEMDEBUG_ASCII_STATS 1 */
 /*
  * Prints out an info table about memory sources array "sources" of size "n".
- * "details" boolean for detailed statistics (memleaks).
+ * "details" boolean for detailed statistics (memleaks, debug builds only).
+ * Allocation rates are per second since the previous call.
  */
 void xmemstat(struct memory_source **sources, size_t n, int details);
@@ -1,4 +1,5 @@
 #include <time.h>
+#include <ctype.h>
 #include "settings.h"
 #include "builtin-widgets.h"
 
@@ -48,6 +49,88 @@ static void free_clock_theme(struct clock_theme *ct)
   Clock interface
 **************************************************************************/
 
+/* Returns the period (in seconds) of the fastest changing strftime field in
+ * the format: 1 (seconds), 60 (minutes), 3600 (hours) or 86400 (days).
+ */
+static int get_format_granularity(const char *fmt)
+{
+	int granularity = 86400;
+	const char *c = fmt;
+	while ((c = strchr(c, '%')) != 0) {
+		c++;
+		/* flags, field width and modifiers */
+		while (*c && strchr("_-0^#", *c))
+			c++;
+		while (isdigit(*c))
+			c++;
+		if (*c == 'E' || *c == 'O')
+			c++;
+
+		switch (*c) {
+		case '\0':
+			return granularity;
+		case 'S': case 's': case 'T': case 'r': case 'c':
+		case 'X': case '+':
+			return 1;
+		case 'M': case 'R':
+			granularity = 60;
+			break;
+		case 'H': case 'I': case 'k': case 'l': case 'p': case 'P':
+			if (granularity > 3600)
+				granularity = 3600;
+			break;
+		default:
+			break;
+		}
+		c++;
+	}
+	return granularity;
+}
+
+/* the monotonic clock doesn't run while suspended, a long sleep is cut so
+ * that the text is right soon after resume */
+#define CLOCK_MAX_SLEEP_MS 60000
+
+/* next moment (in ms, see get_time_ms) when the clock text might change */
+static int64_t get_next_change_time(int granularity)
+{
+	time_t now = time(0);
+	struct tm tm = *localtime(&now);
+	time_t next;
+
+	switch (granularity) {
+	case 1:
+		next = now + 1;
+		break;
+	case 60:
+		next = now - tm.tm_sec + 60;
+		break;
+	case 3600:
+		next = now - tm.tm_min * 60 - tm.tm_sec + 3600;
+		break;
+	default:
+		tm.tm_mday++;
+		tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+		tm.tm_isdst = -1;
+		next = mktime(&tm);
+		break;
+	}
+
+	/* the boundary is in wall time, deadlines are monotonic */
+	int64_t delay = (int64_t)next * 1000 - g_get_real_time() / 1000;
+	if (delay < 0)
+		delay = 0;
+	if (delay > CLOCK_MAX_SLEEP_MS)
+		delay = CLOCK_MAX_SLEEP_MS;
+	return get_time_ms() + delay;
+}
+
+static void schedule_clock_tick(struct widget *w)
+{
+	struct clock_widget *cw = (struct clock_widget*)w->private;
+	schedule_widget_tick(w, get_next_change_time(cw->granularity));
+}
+
 static void fill_buftime(char *buf, size_t size, struct clock_theme *ct)
 {
 	time_t current_time;
@@ -90,8 +173,11 @@ static int create_widget_private(struct widget *w, struct config_format_entry *e
 	cw->mouse_button = parse_int("clock_mouse_button",
 				     &g_settings.root, 1);
 
+	cw->granularity = get_format_granularity(cw->theme.time_format);
+
 	w->private = cw;
 	w->width = get_clock_width(w, 0);
+	schedule_clock_tick(w);
 	return 0;
 }
 
@@ -155,6 +241,8 @@ static void clock_tick(struct widget *w)
 	static char buflasttime[128];
 	char buftime[128];
 
+	schedule_clock_tick(w);
+
 	time_t current_time;
 	current_time = time(0);
 	strftime(buftime, sizeof(buftime), cw->theme.time_format, localtime(&current_time));
@@ -5,8 +5,9 @@ static int create_widget_private(struct widget *w, struct config_format_entry *e
 static void destroy_widget_private(struct widget *w);
 static void draw(struct widget *w);
 static void button_click(struct widget *w, XButtonEvent *e);
-static void prop_change(struct widget *w, XPropertyEvent *e);
+static void client_change(struct widget *w, unsigned int change, Window win);
 static void client_msg(struct widget *w, XClientMessageEvent *e);
+static void add_event_routes(struct widget *w);
 
 static void dnd_drop(struct widget *w, struct drag_info *di);
 
@@ -20,9 +21,10 @@ struct widget_interface desktops_interface = {
 	.destroy_widget_private = destroy_widget_private,
 	.draw			= draw,
 	.button_click		= button_click,
-	.prop_change		= prop_change,
+	.client_change		= client_change,
 	.dnd_drop		= dnd_drop,
 	.client_msg		= client_msg,
+	.add_event_routes	= add_event_routes,
 	.mouse_motion		= mouse_motion,
 	.mouse_leave		= mouse_leave
 };
@@ -31,6 +33,18 @@ struct widget_interface desktops_interface = {
   Desktop switcher theme
 **************************************************************************/
 
+static int parse_desktops_state_images(struct desktops_state *ds,
+				       struct config_format_entry *e,
+				       struct config_format_tree *tree)
+{
+	if (parse_triple_image(&ds->background, e, tree, 1))
+		return -1;
+
+	ds->left_corner = parse_image_part_named("left_corner", e, tree, 0);
+	ds->right_corner = parse_image_part_named("right_corner", e, tree, 0);
+	return 0;
+}
+
 static int parse_desktops_state(struct desktops_state *ds, const char *name,
 				struct config_format_entry *e,
 				struct config_format_tree *tree,
@@ -44,17 +58,34 @@ static int parse_desktops_state(struct desktops_state *ds, const char *name,
 		return -1;
 	}
 
-	if (parse_triple_image(&ds->background, ee, tree, 1))
+	if (is_lazy_theme_state(name)) {
+		ds->pending = ee;
+		ds->pending_tree = tree;
+	} else if (parse_desktops_state_images(ds, ee, tree)) {
 		return -1;
+	}
 
+	/* the font is required for the layout anyway */
 	parse_text_info_named(&ds->font, "font", ee, 0);
-	ds->left_corner = parse_image_part_named("left_corner", ee, tree, 0);
-	ds->right_corner = parse_image_part_named("right_corner", ee, tree, 0);
 
 	ds->exists = 1;
 	return 0;
 }
 
+/* parses images of a lazy state, returns false if the state doesn't exist */
+static int resolve_desktops_state(struct desktops_state *ds)
+{
+	if (ds->pending) {
+		struct config_format_entry *ee = ds->pending;
+		ds->pending = 0;
+		if (parse_desktops_state_images(ds, ee, ds->pending_tree)) {
+			free_text_info(&ds->font);
+			ds->exists = 0;
+		}
+	}
+	return ds->exists;
+}
+
 static void free_desktops_state(struct desktops_state *ds)
 {
 	if (ds->exists) {
@@ -112,40 +143,14 @@ static void free_desktops(struct desktops_widget *dw)
 	CLEAR_ARRAY(dw->desktops);
 }
 
-static void update_active_desktop(struct desktops_widget *dw, struct x_connection *c)
-{
-	dw->active = x_get_prop_int(c, c->root,
-				    c->atoms[XATOM_NET_CURRENT_DESKTOP]);
-}
-
-static void switch_desktop(int desktop, struct x_connection *c)
-{
-	int desktops = x_get_prop_int(c, c->root,
-				      c->atoms[XATOM_NET_NUMBER_OF_DESKTOPS]);
-	if (desktop >= desktops)
-		return;
-
-	x_send_netwm_message(c, c->root, c->atoms[XATOM_NET_CURRENT_DESKTOP],
-			     desktop, 0, 0, 0, 0);
-}
-
-static void update_desktops(struct desktops_widget *dw, struct x_connection *c)
+static void update_desktops(struct desktops_widget *dw, struct ewmh_clients *cl)
 {
 	free_desktops(dw);
-	update_active_desktop(dw, c);
-	int desktops_n = x_get_prop_int(c, c->root,
-					c->atoms[XATOM_NET_NUMBER_OF_DESKTOPS]);
-	char *name, *names;
 	size_t i;
-	names = name = x_get_prop_data(c, c->root,
-				       c->atoms[XATOM_NET_DESKTOP_NAMES],
-				       c->atoms[XATOM_UTF8_STRING], 0);
-
-	for (i = 0; i < desktops_n; ++i) {
+	for (i = 0; i < cl->desktops_n; ++i) {
 		struct desktops_desktop d = {0,0,0,0};
-		if (names) {
-			d.name = xstrdup(name);
-			name += strlen(name) + 1;
+		if (cl->desktop_names[i]) {
+			d.name = xstrdup(cl->desktop_names[i]);
 		} else {
 			char buf[16];
 			snprintf(buf, sizeof(buf), "%zu", i+1);
@@ -153,9 +158,6 @@ static void update_desktops(struct desktops_widget *dw, struct x_connection *c)
 		}
 		ARRAY_APPEND(dw->desktops, d);
 	}
-
-	if (names)
-		XFree(names);
 }
 
 static void resize_desktops(struct widget *w)
@@ -232,8 +234,7 @@ static int create_widget_private(struct widget *w, struct config_format_entry *e
 	INIT_ARRAY(dw->desktops, 16);
 	w->private = dw;
 
-	struct x_connection *c = &w->panel->connection;
-	update_desktops(dw, c);
+	update_desktops(dw, &w->panel->clients);
 	resize_desktops(w);
 	dw->highlighted = -1;
 
@@ -253,6 +254,7 @@ static void draw(struct widget *w)
 {
 	struct desktops_widget *dw = (struct desktops_widget*)w->private;
 	struct desktops_state *idle = &dw->theme.states[BUTTON_STATE_IDLE];
+	int active = w->panel->clients.current_desktop;
 	cairo_t *cr = w->panel->cr;
 	size_t i;
 
@@ -266,11 +268,11 @@ static void draw(struct widget *w)
 	int h = w->panel->height;
 
 	for (i = 0; i < dw->desktops_n; ++i) {
-		int state = (i == dw->active) << 1;
-		int state_hl = ((i == dw->active) << 1) | (i == dw->highlighted);
+		int state = (i == active) << 1;
+		int state_hl = ((i == active) << 1) | (i == dw->highlighted);
 		struct desktops_state *cur;
 
-		if (dw->theme.states[state_hl].exists)
+		if (resolve_desktops_state(&dw->theme.states[state_hl]))
 			cur = &dw->theme.states[state_hl];
 		else
 			cur = &dw->theme.states[state];
@@ -311,47 +313,44 @@ static void draw(struct widget *w)
 
 static void button_click(struct widget *w, XButtonEvent *e)
 {
-	struct desktops_widget *dw = (struct desktops_widget*)w->private;
+	struct ewmh_clients *cl = &w->panel->clients;
 	int di = get_desktop_at(w, e->x);
 	if (di == -1)
 		return;
 
-	struct x_connection *c = &w->panel->connection;
-
 	int mbutton_use = check_mbutton_condition(w->panel, e->button, MBUTTON_USE);
 
-	if (mbutton_use && e->type == ButtonRelease && dw->active != di)
-		switch_desktop(di, c);
+	if (mbutton_use && e->type == ButtonRelease && cl->current_desktop != di)
+		ewmh_switch_desktop(cl, di);
 }
 
-static void prop_change(struct widget *w, XPropertyEvent *e)
+static void client_change(struct widget *w, unsigned int change, Window win)
 {
 	struct desktops_widget *dw = (struct desktops_widget*)w->private;
-	struct x_connection *c = &w->panel->connection;
 
-	if (e->window == c->root) {
-		if (e->atom == c->atoms[XATOM_NET_NUMBER_OF_DESKTOPS] ||
-		    e->atom == c->atoms[XATOM_NET_DESKTOP_NAMES])
-		{
-			update_desktops(dw, c);
-			resize_desktops(w);
-			recalculate_widgets_sizes(w->panel);
-			return;
-		}
-
-		if (e->atom == c->atoms[XATOM_NET_CURRENT_DESKTOP]) {
-			update_active_desktop(dw, c);
-			w->needs_expose = 1;
-			return;
-		}
+	if (change == EWMH_DESKTOPS) {
+		update_desktops(dw, &w->panel->clients);
+		resize_desktops(w);
+		recalculate_widgets_sizes(w->panel);
+		return;
 	}
+
+	if (change == EWMH_CURRENT_DESKTOP)
+		w->needs_expose = 1;
+}
+
+static void add_event_routes(struct widget *w)
+{
+	struct x_connection *c = &w->panel->connection;
+
+	add_event_route(w, ClientMessage, w->panel->win,
+			c->atoms[XATOM_XDND_POSITION]);
 }
 
 static void client_msg(struct widget *w, XClientMessageEvent *e)
 {
 	struct panel *p = w->panel;
 	struct x_connection *c = &p->connection;
-	struct desktops_widget *dw = (struct desktops_widget*)w->private;
 
 	if (e->message_type == c->atoms[XATOM_XDND_POSITION]) {
 		int x = (e->data.l[2] >> 16) & 0xFFFF;
@@ -361,8 +360,8 @@ static void client_msg(struct widget *w, XClientMessageEvent *e)
 			return;
 
 		int di = get_desktop_at(w, x - p->x);
-		if (di != -1 && di != dw->active)
-				switch_desktop(di, c);
+		if (di != -1 && di != p->clients.current_desktop)
+				ewmh_switch_desktop(&p->clients, di);
 
 		x_send_dnd_message(c, e->data.l[0],
 				   c->atoms[XATOM_XDND_STATUS],
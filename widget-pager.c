@@ -1,3 +1,4 @@
+#define XMALLOC_SOURCE msrc_pager
 #include <math.h>
 #include "settings.h"
 #include "builtin-widgets.h"
@@ -6,15 +7,19 @@ static int create_widget_private(struct widget *w, struct config_format_entry *e
 		struct config_format_tree *tree);
 static void destroy_widget_private(struct widget *w);
 static void draw(struct widget *w);
+static void partial_draw(struct widget *w);
 static void button_click(struct widget *w, XButtonEvent *e);
 static void prop_change(struct widget *w, XPropertyEvent *e);
 static void client_msg(struct widget *w, XClientMessageEvent *e);
+static void add_event_routes(struct widget *w);
+static void client_change(struct widget *w, unsigned int change, Window win);
 
 static void dnd_drop(struct widget *w, struct drag_info *di);
 
-static void configure(struct widget *w, XConfigureEvent *e);
 static void mouse_motion(struct widget *w, XMotionEvent *e);
 static void mouse_leave(struct widget *w);
+static void damage_notify(struct widget *w, Window win);
+static void clock_tick(struct widget *w);
 static void reconfigure(struct widget *w);
 
 struct widget_interface pager_interface = {
@@ -23,13 +28,17 @@ struct widget_interface pager_interface = {
 	.create_widget_private	= create_widget_private,
 	.destroy_widget_private = destroy_widget_private,
 	.draw			= draw,
+	.partial_draw		= partial_draw,
 	.button_click		= button_click,
 	.prop_change		= prop_change,
 	.dnd_drop		= dnd_drop,
 	.client_msg		= client_msg,
-	.configure		= configure,
+	.add_event_routes	= add_event_routes,
+	.client_change		= client_change,
 	.mouse_motion		= mouse_motion,
 	.mouse_leave		= mouse_leave,
+	.damage_notify		= damage_notify,
+	.clock_tick		= clock_tick,
 	.reconfigure		= reconfigure
 };
 
@@ -105,186 +114,561 @@ static void free_pager_theme(struct pager_theme *pt)
 }
 
 /**************************************************************************
-  Tasks management
+  Desktops management
 **************************************************************************/
 
-static gboolean task_remove_dead(Window *win, struct pager_task *t, void *notused)
+static void free_desktops(struct pager_widget *pw)
 {
-	if (t->alive) {
-		t->alive = 0;
-		return 0;
+	size_t i;
+	for (i = 0; i < pw->desktops_n; ++i)
+		FREE_ARRAY(pw->desktops[i].bucket.tasks);
+	CLEAR_ARRAY(pw->desktops);
+}
+
+static void update_desktops(struct pager_widget *pw, struct ewmh_clients *cl)
+{
+	free_desktops(pw);
+	pw->layout_valid = 0;
+	int i;
+	for (i = 0; i < cl->desktops_n; ++i) {
+		struct pager_desktop d;
+		CLEAR_STRUCT(&d);
+		ARRAY_APPEND(pw->desktops, d);
 	}
-	xfree(t);
-	return 1;
 }
 
-static gboolean task_remove_all(Window *win, struct pager_task *t, void *notused)
+static void resize_desktops(struct widget *w)
 {
-	xfree(t);
-	return 1;
+	struct x_connection *c = &w->panel->connection;
+	struct pager_widget *pw = (struct pager_widget*)w->private;
+	if (pw->theme.height > w->panel->height)
+		pw->theme.height = w->panel->height - 2;
+	pw->layout_valid = 0;
+
+	const struct x_monitor *xmon = &c->monitors[w->panel->monitor];
+	struct rect mon = {xmon->x, xmon->y, xmon->width, xmon->height};
+	if (!pw->current_monitor_only) {
+		mon.x = mon.y = 0;
+		mon.w = c->screen_width;
+		mon.h = c->screen_height;
+	}
+
+	int workareas_n = 0;
+	long *workareas = x_get_prop_data(c, c->root, c->atoms[XATOM_NET_WORKAREA],
+					  XA_CARDINAL, &workareas_n);
+
+	int width = 0;
+	size_t i;
+	for (i = 0; i < pw->desktops_n; ++i) {
+		struct pager_desktop *pd = &pw->desktops[i];
+		struct rect workarea;
+		if (i < workareas_n / 4) {
+			workarea.x = workareas[4*i+0];
+			workarea.y = workareas[4*i+1];
+			workarea.w = workareas[4*i+2];
+			workarea.h = workareas[4*i+3];
+		} else {
+			memcpy(&workarea, &mon, sizeof(struct rect));
+		}
+		rect_intersection(&pd->workarea, &workarea, &mon);
+		pd->div = pd->workarea.h / (pw->theme.height - 2);
+		pd->w = (mon.w / pd->div) + 2;
+		width += pd->w;
+	}
+	XFree(workareas);
+
+	w->width = width + (pw->desktops_n - 1) * pw->theme.desktop_spacing;
 }
 
-static void get_window_position(struct x_connection *c, struct pager_task *t, Window win)
+/* repaint only that desktop on the next expose, -1 means all of them */
+static void mark_desktop_dirty(struct widget *w, int desktop)
 {
-	XWindowAttributes winattrs;
-	XGetWindowAttributes(c->dpy, win, &winattrs);
-	t->w = winattrs.width;
-	t->h = winattrs.height;
-	x_translate_coordinates(c, 0, 0, &t->x, &t->y, win);
+	struct pager_widget *pw = (struct pager_widget*)w->private;
+	if (w->needs_expose)
+		return;
+
+	/* positions are outdated, the whole widget will be redrawn */
+	if (!pw->layout_valid) {
+		w->needs_expose = 1;
+		return;
+	}
 
-	long *extents = x_get_prop_data(c, win, c->atoms[XATOM_NET_FRAME_EXTENTS],
-					XA_CARDINAL, 0);
-	if (extents) {
-		t->x -= extents[0]; t->w += extents[0] + extents[1];
-		t->y -= extents[2]; t->h += extents[2] + extents[3];
-		XFree(extents);
+	size_t i;
+	for (i = 0; i < pw->desktops_n; ++i) {
+		if (desktop == -1 || (size_t)desktop == i) {
+			pw->desktops[i].needs_expose = 1;
+			w->needs_partial_expose = 1;
+		}
 	}
 }
 
-static void select_window_input(struct x_connection *c, Window win)
+/**************************************************************************
+  Thumbnails
+
+  With "pager_thumbnails" client windows are redirected (automatically, so
+  they are still shown on the screen) and their contents are downscaled by
+  XRender into small pixmaps. XDamage reports a change once, until the
+  damage is subtracted at the next capture, and captures are done not more
+  often than "pager_thumbnail_rate" times per second, so a busy window
+  costs one wakeup per capture. Unmapped windows keep their last contents.
+**************************************************************************/
+
+static int damage_event_type(struct x_connection *c)
+{
+#ifdef HAVE_COMPOSITE
+	return c->damage_event_base + XDamageNotify;
+#else
+	return -1;
+#endif
+}
+
+static void create_thumbnail(struct widget *w, struct pager_task *t)
 {
-	XWindowAttributes winattrs;
-	XGetWindowAttributes(c->dpy, win, &winattrs);
-	long mask = winattrs.your_event_mask | PropertyChangeMask | StructureNotifyMask;
-	XSelectInput(c->dpy, win, mask);
+#ifdef HAVE_COMPOSITE
+	struct x_connection *c = &w->panel->connection;
+	struct pager_thumbnail *th = &t->thumb;
+
+	x_set_error_trap();
+	XCompositeRedirectWindow(c->dpy, t->win, CompositeRedirectAutomatic);
+	th->damage = XDamageCreate(c->dpy, t->win, XDamageReportNonEmpty);
+	if (x_done_error_trap()) {
+		th->damage = None;
+		return;
+	}
+	th->dirty = 1;
+	add_event_route(w, damage_event_type(c), t->win, None);
+#endif
 }
 
-static int update_tasks(struct widget *w)
+static void free_thumbnail(struct widget *w, struct pager_task *t)
 {
+#ifdef HAVE_COMPOSITE
 	struct x_connection *c = &w->panel->connection;
+	struct pager_thumbnail *th = &t->thumb;
+	if (th->damage == None)
+		return;
+
+	remove_event_routes(w, t->win);
+	if (th->pixmap != None)
+		XFreePixmap(c->dpy, th->pixmap);
+
+	/* the window may be gone already */
+	x_set_error_trap();
+	XDamageDestroy(c->dpy, th->damage);
+	XCompositeUnredirectWindow(c->dpy, t->win, CompositeRedirectAutomatic);
+	x_done_error_trap();
+	CLEAR_STRUCT(th);
+#endif
+}
+
+static void set_thumbnails(struct widget *w, int enabled)
+{
 	struct pager_widget *pw = (struct pager_widget*)w->private;
-	if (pw->windows)
-		XFree(pw->windows);
+	size_t i;
+
+	if (enabled == pw->thumbnails)
+		return;
+	pw->thumbnails = enabled;
+	for (i = 0; i < pw->tasks_n; ++i) {
+		if (enabled)
+			create_thumbnail(w, &pw->tasks[i]);
+		else
+			free_thumbnail(w, &pw->tasks[i]);
+	}
+	w->needs_expose = 1;
+}
+
+/* returns true if the thumbnail has new contents */
+static int capture_thumbnail(struct widget *w, struct pager_task *t)
+{
+#ifdef HAVE_COMPOSITE
+	struct x_connection *c = &w->panel->connection;
+	struct pager_thumbnail *th = &t->thumb;
+	XWindowAttributes attrs;
+	int ret = 0;
 
-	pw->windows = x_get_prop_data(c, c->root, c->atoms[XATOM_NET_CLIENT_LIST_STACKING],
-				      XA_WINDOW, &pw->windows_n);
-	if (!pw->windows_n)
+	th->dirty = 0;
+	if (th->want_w <= 0 || th->want_h <= 0)
 		return 0;
 
-	int needs_expose = 0;
-	size_t i;
-	struct pager_task *t;
-	for (i = 0; i < pw->windows_n; ++i) {
-		Window win = pw->windows[i];
-		t = g_hash_table_lookup(pw->tasks, &win);
-		if (t) {
-			t->alive = 1;
-			if (t->stackpos != i) {
-				t->stackpos = i;
-				needs_expose = 1;
-			}
-		} else {
-			t = xmallocz(sizeof(struct pager_task));
-			select_window_input(c, win);
-			get_window_position(c, t, win);
-			t->win = win;
-			t->alive = 1;
-			t->desktop = x_get_window_desktop(c, win);
-			t->visible = x_is_window_visible_on_screen(c, win);
-			t->visible_on_panel = x_is_window_visible_on_panel(c, win);
-			t->stackpos = i;
-
-			g_hash_table_insert(pw->tasks, &t->win, t);
-			needs_expose = 1;
-		}
+	x_set_error_trap();
+	/* changes after this point will be reported again */
+	XDamageSubtract(c->dpy, th->damage, None, None);
+	if (!XGetWindowAttributes(c->dpy, t->win, &attrs) ||
+	    attrs.map_state != IsViewable || !attrs.width || !attrs.height)
+		goto out;
+
+	XRenderPictFormat *srcfmt = XRenderFindVisualFormat(c->dpy, attrs.visual);
+	XRenderPictFormat *dstfmt = XRenderFindVisualFormat(c->dpy,
+							    c->default_visual);
+	if (!srcfmt || !dstfmt)
+		goto out;
+
+	if (th->pixmap == None || th->w != th->want_w || th->h != th->want_h) {
+		if (th->pixmap != None)
+			XFreePixmap(c->dpy, th->pixmap);
+		th->w = th->want_w;
+		th->h = th->want_h;
+		th->pixmap = XCreatePixmap(c->dpy, c->root, th->w, th->h,
+					   c->default_depth);
 	}
 
-	g_hash_table_foreach_remove(pw->tasks, (GHRFunc)task_remove_dead, 0);
-	return needs_expose;
+	XRenderPictureAttributes pa;
+	pa.subwindow_mode = IncludeInferiors;
+	Picture src = XRenderCreatePicture(c->dpy, t->win, srcfmt,
+					   CPSubwindowMode, &pa);
+	Picture dst = XRenderCreatePicture(c->dpy, th->pixmap, dstfmt, 0, 0);
+
+	XTransform xf = {{
+		{XDoubleToFixed((double)attrs.width / th->w), 0, 0},
+		{0, XDoubleToFixed((double)attrs.height / th->h), 0},
+		{0, 0, XDoubleToFixed(1.0)}
+	}};
+	XRenderSetPictureTransform(c->dpy, src, &xf);
+	XRenderSetPictureFilter(c->dpy, src, FilterBilinear, 0, 0);
+	XRenderComposite(c->dpy, PictOpSrc, src, None, dst,
+			 0, 0, 0, 0, 0, 0, th->w, th->h);
+
+	XRenderFreePicture(c->dpy, src);
+	XRenderFreePicture(c->dpy, dst);
+	ret = 1;
+out:
+	if (x_done_error_trap())
+		ret = 0;
+	return ret;
+#else
+	return 0;
+#endif
 }
 
-static void clear_tasks(struct pager_widget *pw)
+/* captures the thumbnail if it's dirty and the rate limit allows it,
+ * schedules a tick otherwise */
+static void update_thumbnail(struct widget *w, struct pager_task *t,
+			     int64_t now)
 {
-	g_hash_table_foreach_remove(pw->tasks, (GHRFunc)task_remove_all, 0);
-	g_hash_table_destroy(pw->tasks);
-	if (pw->windows)
-		XFree(pw->windows);
+	struct pager_widget *pw = (struct pager_widget*)w->private;
+	struct pager_thumbnail *th = &t->thumb;
+
+	if (!th->dirty)
+		return;
+	if (th->next_update > now) {
+		schedule_widget_tick(w, th->next_update);
+		return;
+	}
+
+	if (capture_thumbnail(w, t))
+		mark_desktop_dirty(w, t->desktop);
+	if (pw->thumbnail_rate > 0)
+		th->next_update = now + 1000 / pw->thumbnail_rate;
+}
+
+/* called by the draw code, the capture is done on the next tick */
+static void request_thumbnail_size(struct widget *w, struct pager_task *t,
+				   int width, int height)
+{
+	struct pager_thumbnail *th = &t->thumb;
+	th->want_w = width;
+	th->want_h = height;
+	if (th->w == width && th->h == height)
+		return;
+
+	th->dirty = 1;
+	int64_t now = get_time_ms();
+	schedule_widget_tick(w, th->next_update > now ? th->next_update : now);
+}
+
+static void draw_thumbnail(struct widget *w, struct pager_task *t,
+			   struct rect *winr, struct rect *clip)
+{
+	struct x_connection *c = &w->panel->connection;
+	struct pager_thumbnail *th = &t->thumb;
+	cairo_t *cr = w->panel->cr;
+
+	cairo_surface_t *s = cairo_xlib_surface_create(c->dpy, th->pixmap,
+						       c->default_visual,
+						       th->w, th->h);
+	cairo_save(cr);
+	cairo_rectangle(cr, clip->x, clip->y, clip->w, clip->h);
+	cairo_clip(cr);
+	/* the size may be outdated until the next capture */
+	cairo_translate(cr, winr->x, winr->y);
+	cairo_scale(cr, (double)winr->w / th->w, (double)winr->h / th->h);
+	cairo_set_source_surface(cr, s, 0, 0);
+	cairo_paint(cr);
+	cairo_restore(cr);
+	cairo_surface_destroy(s);
 }
 
 /**************************************************************************
-  Desktops management
+  Tasks
+
+  Tasks are kept in stacking order, each desktop has a bucket of indices
+  of its tasks, so drawing a desktop touches only its windows and the
+  sticky ones. Restacking reorders everything and rebuilds the buckets,
+  the other changes are applied to the single task.
 **************************************************************************/
 
-static void free_desktops(struct pager_widget *pw)
+static struct pager_bucket *get_task_bucket(struct pager_widget *pw,
+					    int desktop)
 {
-	CLEAR_ARRAY(pw->desktops);
+	if (desktop == -1)
+		return &pw->sticky;
+	if (desktop >= 0 && (size_t)desktop < pw->desktops_n)
+		return &pw->desktops[desktop].bucket;
+	/* not on any of the pager desktops */
+	return 0;
 }
 
-static void update_active(struct pager_widget *pw, struct x_connection *c)
+static void bucket_insert(struct pager_bucket *b, size_t ti)
 {
-	pw->active_win = x_get_prop_window(c, c->root, c->atoms[XATOM_NET_ACTIVE_WINDOW]);
+	size_t lo = 0, hi = b->tasks_n;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (b->tasks[mid] < ti)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == b->tasks_n)
+		ARRAY_APPEND(b->tasks, ti);
+	else
+		ARRAY_INSERT_BEFORE(b->tasks, lo, ti);
 }
 
-static void update_active_desktop(struct pager_widget *pw, struct x_connection *c)
+static void bucket_remove(struct pager_bucket *b, size_t ti)
 {
-	pw->active = x_get_prop_int(c, c->root,
-				    c->atoms[XATOM_NET_CURRENT_DESKTOP]);
+	size_t i;
+	for (i = 0; i < b->tasks_n; ++i) {
+		if (b->tasks[i] == ti) {
+			ARRAY_REMOVE(b->tasks, i);
+			return;
+		}
+	}
 }
 
-static void switch_desktop(int desktop, struct x_connection *c)
+/* indices above the removed task are shifted down */
+static void bucket_task_removed(struct pager_bucket *b, size_t ti)
 {
-	int desktops = x_get_prop_int(c, c->root,
-				      c->atoms[XATOM_NET_NUMBER_OF_DESKTOPS]);
-	if (desktop >= desktops)
-		return;
-
-	x_send_netwm_message(c, c->root, c->atoms[XATOM_NET_CURRENT_DESKTOP],
-			     desktop, 0, 0, 0, 0);
+	size_t i;
+	for (i = 0; i < b->tasks_n; ++i) {
+		if (b->tasks[i] > ti)
+			b->tasks[i]--;
+	}
 }
 
-static void update_desktops(struct pager_widget *pw, struct x_connection *c)
+static void rebuild_buckets(struct pager_widget *pw)
 {
-	free_desktops(pw);
-	update_active_desktop(pw, c);
-	int desktops_n = x_get_prop_int(c, c->root,
-					c->atoms[XATOM_NET_NUMBER_OF_DESKTOPS]);
 	size_t i;
-	for (i = 0; i < desktops_n; ++i) {
-		struct pager_desktop d = {0, 0, 0, 0};
-		ARRAY_APPEND(pw->desktops, d);
+	for (i = 0; i < pw->desktops_n; ++i)
+		CLEAR_ARRAY(pw->desktops[i].bucket.tasks);
+	CLEAR_ARRAY(pw->sticky.tasks);
+
+	/* appending in stacking order keeps the buckets sorted */
+	for (i = 0; i < pw->tasks_n; ++i) {
+		struct pager_bucket *b = get_task_bucket(pw, pw->tasks[i].desktop);
+		if (b)
+			ARRAY_APPEND(b->tasks, i);
 	}
 }
 
-static void resize_desktops(struct widget *w)
+/* desktop and sticky tasks, merged in stacking order */
+struct desktop_tasks_iter {
+	const struct pager_bucket *desktop;
+	const struct pager_bucket *sticky;
+	size_t j;
+	size_t k;
+};
+
+static void init_desktop_tasks_iter(struct desktop_tasks_iter *it,
+				    const struct pager_bucket *desktop,
+				    const struct pager_bucket *sticky)
 {
-	struct x_connection *c = &w->panel->connection;
-	struct pager_widget *pw = (struct pager_widget*)w->private;
-	if (pw->theme.height > w->panel->height)
-		pw->theme.height = w->panel->height - 2;
+	it->desktop = desktop;
+	it->sticky = sticky;
+	it->j = it->k = 0;
+}
 
-	const struct x_monitor *xmon = &c->monitors[w->panel->monitor];
-	struct rect mon = {xmon->x, xmon->y, xmon->width, xmon->height};
-	if (!pw->current_monitor_only) {
-		mon.x = mon.y = 0;
-		mon.w = c->screen_width;
-		mon.h = c->screen_height;
+static int next_desktop_task(struct desktop_tasks_iter *it, size_t *ti)
+{
+	const struct pager_bucket *d = it->desktop;
+	const struct pager_bucket *s = it->sticky;
+
+	if (it->j == d->tasks_n && it->k == s->tasks_n)
+		return 0;
+	if (it->k == s->tasks_n ||
+	    (it->j < d->tasks_n && d->tasks[it->j] < s->tasks[it->k]))
+		*ti = d->tasks[it->j++];
+	else
+		*ti = s->tasks[it->k++];
+	return 1;
+}
+
+/* compares the windows shown on the desktop before and after restacking */
+static int desktop_order_changed(struct pager_widget *pw, size_t desktop,
+				 const struct pager_task *old,
+				 const struct pager_bucket *old_buckets)
+{
+	struct desktop_tasks_iter a, b;
+	size_t ta, tb;
+	int more_a, more_b;
+
+	init_desktop_tasks_iter(&a, &old_buckets[desktop],
+				&old_buckets[pw->desktops_n]);
+	init_desktop_tasks_iter(&b, &pw->desktops[desktop].bucket, &pw->sticky);
+	for (;;) {
+		more_a = next_desktop_task(&a, &ta);
+		more_b = next_desktop_task(&b, &tb);
+		if (!more_a || !more_b)
+			return more_a != more_b;
+		if (old[ta].win != pw->tasks[tb].win)
+			return 1;
 	}
+}
 
-	int workareas_n = 0;
-	long *workareas = x_get_prop_data(c, c->root, c->atoms[XATOM_NET_WORKAREA],
-					  XA_CARDINAL, &workareas_n);
+static int find_task(struct pager_widget *pw, Window win)
+{
+	size_t i;
+	for (i = 0; i < pw->tasks_n; ++i) {
+		if (pw->tasks[i].win == win)
+			return (int)i;
+	}
+	return -1;
+}
 
-	int width = 0;
+static void update_task_state(struct x_connection *c, struct pager_task *t)
+{
+	t->on_panel = x_is_window_visible_on_panel(c, t->win) != 0;
+	t->on_screen = x_is_window_visible_on_screen(c, t->win) != 0;
+}
+
+static int compare_tasks(const void *a, const void *b)
+{
+	Window wa = ((const struct pager_task*)a)->win;
+	Window wb = ((const struct pager_task*)b)->win;
+	return (wa > wb) - (wa < wb);
+}
+
+/* builds the tasks from the stacking order, keeping the cached state of the
+ * known windows, desktops which windows were reordered are marked dirty */
+static void rebuild_tasks(struct widget *w)
+{
+	struct pager_widget *pw = (struct pager_widget*)w->private;
+	struct ewmh_clients *cl = &w->panel->clients;
+	struct x_connection *c = &w->panel->connection;
 	size_t i;
+
+	struct pager_task *old = pw->tasks;
+	size_t old_n = pw->tasks_n;
+	struct pager_task *sorted = 0;
+	unsigned char *reused = 0;
+	if (old_n) {
+		sorted = xmalloc(sizeof(struct pager_task) * old_n);
+		memcpy(sorted, old, sizeof(struct pager_task) * old_n);
+		qsort(sorted, old_n, sizeof(struct pager_task), compare_tasks);
+		reused = xmallocz(old_n);
+	}
+
+	/* desktops first, then sticky */
+	struct pager_bucket *old_buckets =
+		xmalloc(sizeof(struct pager_bucket) * (pw->desktops_n + 1));
 	for (i = 0; i < pw->desktops_n; ++i) {
-		struct pager_desktop *pd = &pw->desktops[i];
-		struct rect workarea;
-		if (i < workareas_n / 4) {
-			workarea.x = workareas[4*i+0];
-			workarea.y = workareas[4*i+1];
-			workarea.w = workareas[4*i+2];
-			workarea.h = workareas[4*i+3];
-		} else {
-			memcpy(&workarea, &mon, sizeof(struct rect));
+		old_buckets[i] = pw->desktops[i].bucket;
+		INIT_EMPTY_ARRAY(pw->desktops[i].bucket.tasks);
+	}
+	old_buckets[pw->desktops_n] = pw->sticky;
+	INIT_EMPTY_ARRAY(pw->sticky.tasks);
+
+	INIT_EMPTY_ARRAY(pw->tasks);
+	ENSURE_ARRAY_CAPACITY(pw->tasks, cl->stacking_n);
+
+	for (i = 0; i < cl->stacking_n; ++i) {
+		struct pager_task key, *t;
+		key.win = cl->stacking[i];
+		t = old_n ? bsearch(&key, sorted, old_n, sizeof(struct pager_task),
+				    compare_tasks) : 0;
+		if (t) {
+			ARRAY_APPEND(pw->tasks, *t);
+			reused[t - sorted] = 1;
+			continue;
 		}
-		rect_intersection(&pd->workarea, &workarea, &mon);
-		pd->div = pd->workarea.h / (pw->theme.height - 2);
-		pd->w = (mon.w / pd->div) + 2;
-		width += pd->w;
+
+		/* the stacking order may be updated before the client list */
+		struct ewmh_client *cc = ewmh_find_client(cl, key.win);
+		if (!cc)
+			continue;
+
+		CLEAR_STRUCT(&key);
+		key.win = cc->win;
+		key.desktop = cc->desktop;
+		update_task_state(c, &key);
+		if (pw->thumbnails)
+			create_thumbnail(w, &key);
+		ARRAY_APPEND(pw->tasks, key);
 	}
-	XFree(workareas);
 
-	w->width = width + (pw->desktops_n - 1) * pw->theme.desktop_spacing;
+	/* windows which left the stacking order */
+	for (i = 0; i < old_n; ++i) {
+		if (!reused[i])
+			free_thumbnail(w, &sorted[i]);
+	}
+
+	rebuild_buckets(pw);
+	for (i = 0; i < pw->desktops_n; ++i) {
+		if (desktop_order_changed(pw, i, old, old_buckets))
+			mark_desktop_dirty(w, (int)i);
+	}
+
+	for (i = 0; i <= pw->desktops_n; ++i)
+		FREE_ARRAY(old_buckets[i].tasks);
+	xfree(old_buckets);
+	if (sorted) {
+		xfree(sorted);
+		xfree(reused);
+	}
+	if (old)
+		xfree(old);
+}
+
+static void remove_task(struct pager_widget *pw, size_t ti)
+{
+	struct pager_bucket *b = get_task_bucket(pw, pw->tasks[ti].desktop);
+	if (b)
+		bucket_remove(b, ti);
+	ARRAY_REMOVE(pw->tasks, ti);
+
+	size_t i;
+	for (i = 0; i < pw->desktops_n; ++i)
+		bucket_task_removed(&pw->desktops[i].bucket, ti);
+	bucket_task_removed(&pw->sticky, ti);
+}
+
+static void move_task_to_desktop(struct pager_widget *pw, size_t ti,
+				 int desktop)
+{
+	struct pager_task *t = &pw->tasks[ti];
+	if (t->desktop == desktop)
+		return;
+
+	struct pager_bucket *b = get_task_bucket(pw, t->desktop);
+	if (b)
+		bucket_remove(b, ti);
+	t->desktop = desktop;
+	b = get_task_bucket(pw, desktop);
+	if (b)
+		bucket_insert(b, ti);
+}
+
+static void get_task_geometry(struct ewmh_clients *cl, struct pager_task *t)
+{
+	if (t->geom_valid)
+		return;
+
+	struct ewmh_client *cc = ewmh_find_client(cl, t->win);
+	if (!cc)
+		return;
+	ewmh_client_geometry(cl, cc, &t->geom.x, &t->geom.y,
+			     &t->geom.w, &t->geom.h);
+	t->geom_valid = 1;
 }
 
 static int get_desktop_at(struct widget *w, int x)
@@ -315,17 +699,22 @@ static int create_widget_private(struct widget *w, struct config_format_entry *e
 	}
 
 	INIT_ARRAY(pw->desktops, 16);
+	INIT_ARRAY(pw->tasks, 50);
+	INIT_EMPTY_ARRAY(pw->sticky.tasks);
 	w->private = pw;
 
 	pw->current_monitor_only = parse_bool("pager_current_monitor_only", &g_settings.root);
 
-	struct x_connection *c = &w->panel->connection;
-	update_desktops(pw, c);
-	update_active(pw, c);
+	update_desktops(pw, &w->panel->clients);
 	resize_desktops(w);
+	rebuild_tasks(w);
 	pw->highlighted = -1;
-	pw->tasks = g_hash_table_new(g_int_hash, g_int_equal);
-	update_tasks(w);
+	pw->active = w->panel->clients.active;
+	pw->current_desktop = w->panel->clients.current_desktop;
+
+	pw->thumbnail_rate = parse_int("pager_thumbnail_rate", &g_settings.root, 2);
+	set_thumbnails(w, parse_bool("pager_thumbnails", &g_settings.root) &&
+		       w->panel->connection.composite);
 
 	return 0;
 }
@@ -333,169 +722,264 @@ static int create_widget_private(struct widget *w, struct config_format_entry *e
 static void destroy_widget_private(struct widget *w)
 {
 	struct pager_widget *pw = (struct pager_widget*)w->private;
+	set_thumbnails(w, 0);
 	free_pager_theme(&pw->theme);
 	free_desktops(pw);
 	FREE_ARRAY(pw->desktops);
-	clear_tasks(pw);
+	FREE_ARRAY(pw->tasks);
+	FREE_ARRAY(pw->sticky.tasks);
 	xfree(pw);
 }
 
-static void draw(struct widget *w)
+static struct pager_state *get_desktop_state(struct pager_widget *pw,
+					     int desktop, int active)
+{
+	int state = (desktop == active) << 1;
+	int state_hl = state | (desktop == pw->highlighted);
+
+	if (pw->theme.states[state_hl].exists)
+		return &pw->theme.states[state_hl];
+	return &pw->theme.states[state];
+}
+
+static void get_desktop_rect(struct widget *w, struct pager_desktop *pd,
+			     struct rect *r)
 {
 	struct pager_widget *pw = (struct pager_widget*)w->private;
+	r->x = pd->x;
+	r->y = (w->panel->height - pw->theme.height) / 2;
+	r->w = pd->w;
+	r->h = pw->theme.height;
+}
+
+static void draw_desktop(struct widget *w, size_t i)
+{
+	struct pager_widget *pw = (struct pager_widget*)w->private;
+	struct ewmh_clients *cl = &w->panel->clients;
+	struct pager_desktop *pd = &pw->desktops[i];
+	struct pager_state *ps = get_desktop_state(pw, i, cl->current_desktop);
 	cairo_t *cr = w->panel->cr;
-	PangoLayout *layout = w->panel->layout;
-	size_t i;
 	struct rect r;
-	r.x = w->x;
-	r.y = (w->panel->height - pw->theme.height) / 2;
-	r.h = pw->theme.height;
 
-	struct rect activerect;
-	struct pager_state *activeps = &pw->theme.states[0];
+	get_desktop_rect(w, pd, &r);
+	fill_rectangle(cr, ps->fill, &r);
+
+	r.x++; r.y++; r.w -= 2; r.h -= 2;
+
+	struct desktop_tasks_iter it;
+	size_t ti, visible_tasks_count = 0;
+	init_desktop_tasks_iter(&it, &pd->bucket, &pw->sticky);
+	while (next_desktop_task(&it, &ti)) {
+		struct pager_task *t = &pw->tasks[ti];
+		if (t->on_panel)
+			visible_tasks_count++;
+		if (t->on_screen) {
+			unsigned char *window_fill;
+			unsigned char *window_border;
+			struct rect intersection;
+			struct rect winr;
+			get_task_geometry(cl, t);
+			winr.x = r.x + (t->geom.x - pd->workarea.x) / pd->div;
+			winr.y = r.y + (t->geom.y - pd->workarea.y) / pd->div;
+			winr.w = t->geom.w / pd->div;
+			winr.h = t->geom.h / pd->div;
+			if (t->thumb.damage != None)
+				request_thumbnail_size(w, t, winr.w, winr.h);
+			if (!rect_intersection(&intersection, &winr, &r))
+				continue;
+
+			if (t->win == cl->active) {
+				window_fill = ps->active_window_fill;
+				window_border = ps->active_window_border;
+			} else {
+				window_fill = ps->inactive_window_fill;
+				window_border = ps->inactive_window_border;
+			}
+			if (t->thumb.pixmap != None)
+				draw_thumbnail(w, t, &winr, &intersection);
+			else
+				fill_rectangle(cr, window_fill, &intersection);
+			draw_rectangle_outline(cr, window_border, &intersection);
+		}
+	}
+	pd->num_tasks = (int)visible_tasks_count;
 
-	for (i = 0; i < pw->desktops_n; ++i) {
-		struct pager_desktop *pd = &pw->desktops[i];
-		int state = (i == pw->active) << 1;
-		int state_hl = ((i == pw->active) << 1) | (i == pw->highlighted);
-		struct pager_state *ps;
+	r.x--; r.y--; r.w += 2; r.h += 2;
 
-		if (pw->theme.states[state_hl].exists)
-			ps = &pw->theme.states[state_hl];
-		else
-			ps = &pw->theme.states[state];
+	draw_rectangle_outline(cr, ps->border, &r);
+	if (ps->font.pfd && visible_tasks_count) {
+		/* draw number */
+		char buf[10];
+		snprintf(buf, sizeof(buf), "%zu", visible_tasks_count);
+		draw_text(cr, w->panel->layout, &ps->font, buf,
+			  r.x, r.y, r.w, r.h, 0);
+	}
+}
 
-		pd->x = r.x;
-		r.w = pd->w;
-		fill_rectangle(cr, ps->fill, &r);
+static void draw(struct widget *w)
+{
+	struct pager_widget *pw = (struct pager_widget*)w->private;
+	int active = w->panel->clients.current_desktop;
+	int x = w->x;
+	size_t i;
 
-		if (pw->active == i) {
-			activerect = r;
-			activeps = ps;
-		}
+	for (i = 0; i < pw->desktops_n; ++i) {
+		struct pager_desktop *pd = &pw->desktops[i];
+		pd->x = x;
+		pd->needs_expose = 0;
+		draw_desktop(w, i);
+		x += pd->w + pw->theme.desktop_spacing;
+	}
+	pw->layout_valid = 1;
+
+	if (active >= 0 && (size_t)active < pw->desktops_n) {
+		struct rect r;
+		get_desktop_rect(w, &pw->desktops[active], &r);
+		draw_rectangle_outline(w->panel->cr,
+				       get_desktop_state(pw, active, active)->border,
+				       &r);
+	}
+}
 
-		r.x++; r.y++; r.w -= 2; r.h -= 2;
-
-		size_t visible_tasks_count = 0;
-		size_t j;
-		for (j = 0; j < pw->windows_n; ++j) {
-			Window win = pw->windows[j];
-			struct pager_task *t = g_hash_table_lookup(pw->tasks, &win);
-			if (t && t->visible_on_panel && (t->desktop == i || t->desktop == -1))
-				visible_tasks_count++;
-			if (t && t->visible && (t->desktop == i || t->desktop == -1)) {
-				unsigned char *window_fill;
-				unsigned char *window_border;
-				struct rect intersection;
-				struct rect winr;
-				winr.x = r.x + (t->x - pd->workarea.x) / pd->div;
-				winr.y = r.y + (t->y - pd->workarea.y) / pd->div;
-				winr.w = t->w / pd->div;
-				winr.h = t->h / pd->div;
-				if (!rect_intersection(&intersection, &winr, &r))
-					continue;
-
-				if (win == pw->active_win) {
-					window_fill = ps->active_window_fill;
-					window_border = ps->active_window_border;
-				} else {
-					window_fill = ps->inactive_window_fill;
-					window_border = ps->inactive_window_border;
-				}
-				fill_rectangle(cr, window_fill, &intersection);
-				draw_rectangle_outline(cr, window_border, &intersection);
-			}
-		}
+static void partial_draw(struct widget *w)
+{
+	struct pager_widget *pw = (struct pager_widget*)w->private;
 
-		r.x--; r.y--; r.w += 2; r.h += 2;
+	/* desktops were moved since they were marked, redraw everything */
+	if (!pw->layout_valid) {
+		w->needs_expose = 1;
+		return;
+	}
 
-		draw_rectangle_outline(cr, ps->border, &r);
-		if (ps->font.pfd && visible_tasks_count) {
-			/* draw number */
-			char buf[10];
-			snprintf(buf, sizeof(buf), "%zu", visible_tasks_count);
-			draw_text(cr, layout, &ps->font, buf, r.x, r.y, r.w, r.h, 0);
-		}
-		r.x += r.w + pw->theme.desktop_spacing;
+	size_t i;
+	for (i = 0; i < pw->desktops_n; ++i) {
+		struct pager_desktop *pd = &pw->desktops[i];
+		if (!pd->needs_expose)
+			continue;
+
+		pd->needs_expose = 0;
+		begin_partial_expose(w, pd->x, pd->w);
+		draw_desktop(w, i);
+		end_partial_expose(w, pd->x, pd->w);
 	}
-	draw_rectangle_outline(cr, activeps->border, &activerect);
 }
 
 static void button_click(struct widget *w, XButtonEvent *e)
 {
-	struct pager_widget *pw = (struct pager_widget*)w->private;
+	struct ewmh_clients *cl = &w->panel->clients;
 	int di = get_desktop_at(w, e->x);
 	if (di == -1)
 		return;
 
-	struct x_connection *c = &w->panel->connection;
-
 	int mbutton_use = check_mbutton_condition(w->panel, e->button, MBUTTON_USE);
 
-	if (mbutton_use && e->type == ButtonRelease && pw->active != di)
-		switch_desktop(di, c);
+	if (mbutton_use && e->type == ButtonRelease && cl->current_desktop != di)
+		ewmh_switch_desktop(cl, di);
 }
 
 static void prop_change(struct widget *w, XPropertyEvent *e)
 {
-	struct pager_widget *pw = (struct pager_widget*)w->private;
 	struct x_connection *c = &w->panel->connection;
 
-	if (e->window == c->root) {
-		if (e->atom == c->atoms[XATOM_NET_NUMBER_OF_DESKTOPS]) {
-			update_desktops(pw, c);
-			resize_desktops(w);
-			recalculate_widgets_sizes(w->panel);
-			return;
-		}
-
-		if (e->atom == c->atoms[XATOM_NET_WORKAREA]) {
-			resize_desktops(w);
-			recalculate_widgets_sizes(w->panel);
-			return;
-		}
-
-		if (e->atom == c->atoms[XATOM_NET_ACTIVE_WINDOW]) {
-			update_active(pw, c);
-			w->needs_expose = 1;
-			return;
-		}
+	if (e->window == c->root && e->atom == c->atoms[XATOM_NET_WORKAREA]) {
+		resize_desktops(w);
+		recalculate_widgets_sizes(w->panel);
+	}
+}
 
-		if (e->atom == c->atoms[XATOM_NET_CURRENT_DESKTOP]) {
-			update_active_desktop(pw, c);
-			w->needs_expose = 1;
-			return;
-		}
+static void mark_window_dirty(struct widget *w, Window win)
+{
+	struct pager_widget *pw = (struct pager_widget*)w->private;
+	int ti = find_task(pw, win);
+	if (ti != -1)
+		mark_desktop_dirty(w, pw->tasks[ti].desktop);
+}
 
-		if (e->atom == c->atoms[XATOM_NET_CLIENT_LIST_STACKING]) {
-			int needs = update_tasks(w);
-			if (!w->needs_expose)
-				w->needs_expose = needs;
-			return;
-		}
-	}
+static void client_change(struct widget *w, unsigned int change, Window win)
+{
+	struct pager_widget *pw = (struct pager_widget*)w->private;
+	struct ewmh_clients *cl = &w->panel->clients;
+	struct x_connection *c = &w->panel->connection;
+	struct pager_task *t;
+	int ti;
 
-	struct pager_task *t = g_hash_table_lookup(pw->tasks, &e->window);
-	if (!t)
+	switch (change) {
+	case EWMH_DESKTOPS:
+		update_desktops(pw, cl);
+		resize_desktops(w);
+		rebuild_buckets(pw);
+		recalculate_widgets_sizes(w->panel);
 		return;
-
-	if (e->atom == c->atoms[XATOM_NET_WM_DESKTOP]) {
-		t->desktop = x_get_window_desktop(c, t->win);
-		w->needs_expose = 1;
+	case EWMH_CLIENT_ADDED:
+	case EWMH_STACKING:
+		rebuild_tasks(w);
+		return;
+	case EWMH_ACTIVE_WINDOW:
+		mark_window_dirty(w, pw->active);
+		mark_window_dirty(w, cl->active);
+		pw->active = cl->active;
+		return;
+	case EWMH_CURRENT_DESKTOP:
+		mark_desktop_dirty(w, pw->current_desktop);
+		mark_desktop_dirty(w, cl->current_desktop);
+		pw->current_desktop = cl->current_desktop;
 		return;
+	default:
+		break;
 	}
 
-	if (e->atom == c->atoms[XATOM_NET_WM_STATE]) {
-		t->visible = x_is_window_visible_on_screen(c, t->win);
-		t->visible_on_panel = x_is_window_visible_on_panel(c, t->win);
-		w->needs_expose = 1;
+	ti = find_task(pw, win);
+	if (ti == -1)
 		return;
+	t = &pw->tasks[ti];
+
+	switch (change) {
+	case EWMH_CLIENT_REMOVED:
+		mark_desktop_dirty(w, t->desktop);
+		free_thumbnail(w, t);
+		remove_task(pw, ti);
+		break;
+	case EWMH_CLIENT_DESKTOP: {
+		struct ewmh_client *cc = ewmh_find_client(cl, win);
+		if (!cc || cc->desktop == t->desktop)
+			break;
+		mark_desktop_dirty(w, t->desktop);
+		mark_desktop_dirty(w, cc->desktop);
+		move_task_to_desktop(pw, ti, cc->desktop);
+		break;
+	}
+	case EWMH_CLIENT_STATE: {
+		unsigned char on_panel = t->on_panel;
+		unsigned char on_screen = t->on_screen;
+		update_task_state(c, t);
+		if (on_panel != t->on_panel || on_screen != t->on_screen)
+			mark_desktop_dirty(w, t->desktop);
+		break;
+	}
+	case EWMH_CLIENT_GEOMETRY:
+		t->geom_valid = 0;
+		if (t->on_screen)
+			mark_desktop_dirty(w, t->desktop);
+		break;
+	default:
+		break;
 	}
+}
 
-	if (e->atom == c->atoms[XATOM_NET_FRAME_EXTENTS]) {
-		get_window_position(c, t, e->window);
-		w->needs_expose = 1;
-		return;
+static void add_event_routes(struct widget *w)
+{
+	struct pager_widget *pw = (struct pager_widget*)w->private;
+	struct x_connection *c = &w->panel->connection;
+	size_t i;
+
+	add_event_route(w, PropertyNotify, c->root,
+			c->atoms[XATOM_NET_WORKAREA]);
+	add_event_route(w, ClientMessage, w->panel->win,
+			c->atoms[XATOM_XDND_POSITION]);
+	for (i = 0; i < pw->tasks_n; ++i) {
+		if (pw->tasks[i].thumb.damage != None)
+			add_event_route(w, damage_event_type(c),
+					pw->tasks[i].win, None);
 	}
 }
 
@@ -503,7 +987,6 @@ static void client_msg(struct widget *w, XClientMessageEvent *e)
 {
 	struct panel *p = w->panel;
 	struct x_connection *c = &p->connection;
-	struct pager_widget *pw = (struct pager_widget*)w->private;
 
 	if (e->message_type == c->atoms[XATOM_XDND_POSITION]) {
 		int x = (e->data.l[2] >> 16) & 0xFFFF;
@@ -513,8 +996,8 @@ static void client_msg(struct widget *w, XClientMessageEvent *e)
 			return;
 
 		int di = get_desktop_at(w, x - p->x);
-		if (di != -1 && di != pw->active)
-				switch_desktop(di, c);
+		if (di != -1 && di != p->clients.current_desktop)
+				ewmh_switch_desktop(&p->clients, di);
 
 		x_send_dnd_message(c, e->data.l[0],
 				   c->atoms[XATOM_XDND_STATUS],
@@ -544,25 +1027,16 @@ static void dnd_drop(struct widget *w, struct drag_info *di)
 			     (long)desktop, 2, 0, 0, 0);
 }
 
-static void configure(struct widget *w, XConfigureEvent *e)
-{
-	struct x_connection *c = &w->panel->connection;
-	struct pager_widget *pw = (struct pager_widget*)w->private;
-	struct pager_task *t = g_hash_table_lookup(pw->tasks, &e->window);
-	if (!t)
-		return;
-
-	get_window_position(c, t, e->window);
-	w->needs_expose = 1;
-}
-
 static void mouse_motion(struct widget *w, XMotionEvent *e)
 {
 	struct pager_widget *pw = (struct pager_widget*)w->private;
 	int i = get_desktop_at(w, e->x);
 	if (i != pw->highlighted) {
+		if (pw->highlighted != -1)
+			mark_desktop_dirty(w, pw->highlighted);
+		if (i != -1)
+			mark_desktop_dirty(w, i);
 		pw->highlighted = i;
-		w->needs_expose = 1;
 	}
 }
 
@@ -570,11 +1044,32 @@ static void mouse_leave(struct widget *w)
 {
 	struct pager_widget *pw = (struct pager_widget*)w->private;
 	if (pw->highlighted != -1) {
+		mark_desktop_dirty(w, pw->highlighted);
 		pw->highlighted = -1;
-		w->needs_expose = 1;
 	}
 }
 
+static void damage_notify(struct widget *w, Window win)
+{
+	struct pager_widget *pw = (struct pager_widget*)w->private;
+	int ti = find_task(pw, win);
+	if (ti == -1 || pw->tasks[ti].thumb.damage == None)
+		return;
+
+	pw->tasks[ti].thumb.dirty = 1;
+	update_thumbnail(w, &pw->tasks[ti], get_time_ms());
+}
+
+static void clock_tick(struct widget *w)
+{
+	struct pager_widget *pw = (struct pager_widget*)w->private;
+	int64_t now = get_time_ms();
+	size_t i;
+
+	for (i = 0; i < pw->tasks_n; ++i)
+		update_thumbnail(w, &pw->tasks[i], now);
+}
+
 static void reconfigure(struct widget *w)
 {
 	struct pager_widget *pw = (struct pager_widget*)w->private;
@@ -584,4 +1079,8 @@ static void reconfigure(struct widget *w)
 		resize_desktops(w);
 		recalculate_widgets_sizes(w->panel);
 	}
+
+	pw->thumbnail_rate = parse_int("pager_thumbnail_rate", &g_settings.root, 2);
+	set_thumbnails(w, parse_bool("pager_thumbnails", &g_settings.root) &&
+		       w->panel->connection.composite);
 }
@@ -1,3 +1,4 @@
+#include "settings.h"
 #include "builtin-widgets.h"
 
 static int create_widget_private(struct widget *w, struct config_format_entry *e,
@@ -6,8 +7,11 @@ static void destroy_widget_private(struct widget *w);
 static void client_msg(struct widget *w, XClientMessageEvent *e);
 static void win_destroy(struct widget *w, XDestroyWindowEvent *e);
 static void configure(struct widget *w, XConfigureEvent *e);
+static void damage_notify(struct widget *w, Window win);
+static void add_event_routes(struct widget *w);
 static void panel_exposed(struct widget *w);
 static void draw(struct widget *w);
+static void partial_draw(struct widget *w);
 static int retheme_reconfigure(struct widget *w, struct config_format_entry *e,
 			       struct config_format_tree *tree);
 
@@ -19,7 +23,10 @@ struct widget_interface systray_interface = {
 	.client_msg		= client_msg,
 	.win_destroy		= win_destroy,
 	.configure		= configure,
+	.damage_notify		= damage_notify,
+	.add_event_routes	= add_event_routes,
 	.draw			= draw,
+	.partial_draw		= partial_draw,
 	.panel_exposed		= panel_exposed,
 	.retheme_reconfigure	= retheme_reconfigure
 };
@@ -46,6 +53,135 @@ static int tray_selection_owner_exists(struct x_connection *c, Atom traysel)
 	return 0;
 }
 
+/**************************************************************************
+  Composite mode
+**************************************************************************/
+
+/* Icons with a 32-bit visual are embedded into ARGB embedders which are
+ * redirected offscreen. The panel paints their contents into its own buffer
+ * when XDamage reports a change, the embedders are still placed over the
+ * panel for input.
+ */
+
+static int damage_event_type(struct x_connection *c)
+{
+#ifdef HAVE_COMPOSITE
+	return c->damage_event_base + XDamageNotify;
+#else
+	return -1;
+#endif
+}
+
+static int is_argb_icon(struct x_connection *c, Window win)
+{
+	XWindowAttributes winattrs;
+
+	x_set_error_trap();
+	XGetWindowAttributes(c->dpy, win, &winattrs);
+	if (x_done_error_trap())
+		return 0;
+	return winattrs.depth == 32;
+}
+
+static void create_composited_embedder(struct widget *w,
+				       struct systray_icon *ic)
+{
+#ifdef HAVE_COMPOSITE
+	struct systray_widget *sw = (struct systray_widget*)w->private;
+	struct systray_theme *st = &sw->theme;
+	struct x_connection *c = &w->panel->connection;
+
+	XSetWindowAttributes attrs;
+	attrs.colormap = c->argb_colormap;
+	attrs.background_pixel = 0;
+	attrs.border_pixel = 0;
+	ic->embedder = XCreateWindow(c->dpy, w->panel->win, 0, 0,
+				     st->icon_size[0], st->icon_size[1], 0,
+				     32, InputOutput, c->argb_visual,
+				     CWColormap | CWBackPixel | CWBorderPixel,
+				     &attrs);
+	XCompositeRedirectWindow(c->dpy, ic->embedder, CompositeRedirectManual);
+	ic->damage = XDamageCreate(c->dpy, ic->embedder, XDamageReportNonEmpty);
+	ic->composited = 1;
+#endif
+}
+
+static void release_icon_pixmap(struct x_connection *c,
+				struct systray_icon *ic)
+{
+	if (ic->pixmap != None) {
+		XFreePixmap(c->dpy, ic->pixmap);
+		ic->pixmap = None;
+	}
+}
+
+static void free_composited_icon(struct x_connection *c,
+				 struct systray_icon *ic)
+{
+#ifdef HAVE_COMPOSITE
+	if (!ic->composited)
+		return;
+	release_icon_pixmap(c, ic);
+	x_set_error_trap();
+	XDamageDestroy(c->dpy, ic->damage);
+	x_done_error_trap();
+#endif
+}
+
+static void paint_composited_icon(struct widget *w, struct systray_icon *ic,
+				  int x, int y)
+{
+#ifdef HAVE_COMPOSITE
+	struct x_connection *c = &w->panel->connection;
+
+	/* the contents are there only after mapping */
+	if (!ic->mapped)
+		return;
+
+	if (ic->pixmap == None) {
+		x_set_error_trap();
+		ic->pixmap = XCompositeNameWindowPixmap(c->dpy, ic->embedder);
+		if (x_done_error_trap()) {
+			ic->pixmap = None;
+			return;
+		}
+	}
+
+	cairo_surface_t *s = cairo_xlib_surface_create(c->dpy, ic->pixmap,
+						       c->argb_visual,
+						       ic->w, ic->h);
+	cairo_t *cr = w->panel->cr;
+	cairo_save(cr);
+	/* the panel may paint with CAIRO_OPERATOR_SOURCE (see "paint_replace"),
+	 * touch the icon area only and blend the icon over the tray background */
+	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+	cairo_set_source_surface(cr, s, x, y);
+	cairo_rectangle(cr, x, y, ic->w, ic->h);
+	cairo_fill(cr);
+	cairo_restore(cr);
+	cairo_surface_destroy(s);
+#endif
+}
+
+/**************************************************************************
+  Tray icons
+**************************************************************************/
+
+static int icon_x(struct widget *w, size_t i)
+{
+	struct systray_widget *sw = (struct systray_widget*)w->private;
+	struct systray_theme *st = &sw->theme;
+	return w->x + image_width(st->background.left) + st->icon_offset[0] +
+		(int)i * (st->icon_size[0] + st->icon_spacing);
+}
+
+static int icon_y(struct widget *w)
+{
+	struct systray_widget *sw = (struct systray_widget*)w->private;
+	struct systray_theme *st = &sw->theme;
+	return (w->panel->height - st->icon_size[1]) / 2 + st->icon_offset[1];
+}
+
 static void add_tray_icon(struct widget *w, Window win)
 {
 	struct systray_widget *sw = (struct systray_widget*)w->private;
@@ -53,13 +189,16 @@ static void add_tray_icon(struct widget *w, Window win)
 	struct x_connection *c = &w->panel->connection;
 
 	struct systray_icon icon;
-	icon.mapped = 0;
+	CLEAR_STRUCT(&icon);
 	icon.icon = win;
 
 	/* create embedder window */
-	icon.embedder = x_create_default_embedder(c, w->panel->win, win,
-						  st->icon_size[0],
-						  st->icon_size[1]);
+	if (sw->composite && is_argb_icon(c, win))
+		create_composited_embedder(w, &icon);
+	else
+		icon.embedder = x_create_default_embedder(c, w->panel->win, win,
+							  st->icon_size[0],
+							  st->icon_size[1]);
 
 	/* Select structure notifications. Some tray icons require double
 	 * size sets (I don't know why, but it works).
@@ -71,6 +210,10 @@ static void add_tray_icon(struct widget *w, Window win)
 	XMapRaised(c->dpy, icon.icon);
 
 	ARRAY_APPEND(sw->icons, icon);
+	add_event_route(w, DestroyNotify, win, None);
+	add_event_route(w, ConfigureNotify, win, None);
+	if (icon.composited)
+		add_event_route(w, damage_event_type(c), icon.embedder, None);
 }
 
 static void update_systray_width(struct widget *w)
@@ -103,8 +246,13 @@ static void free_tray_icon(struct widget *w, Window win)
 
 	int i = find_tray_icon(sw, win);
 	if (i != -1) {
-		XDestroyWindow(c->dpy, sw->icons[i].embedder);
+		struct systray_icon *ic = &sw->icons[i];
+		remove_event_routes(w, ic->embedder);
+		free_composited_icon(c, ic);
+		XDestroyWindow(c->dpy, ic->embedder);
+		/* icons are placed by their index, keep the order */
 		ARRAY_REMOVE(sw->icons, i);
+		remove_event_routes(w, win);
 	}
 }
 
@@ -117,6 +265,7 @@ static void free_tray_icons(struct widget *w)
 	for (i = 0; i < sw->icons_n; ++i) {
 		struct systray_icon *ic = &sw->icons[i];
 		XReparentWindow(c->dpy, ic->icon, c->root, 0, 0);
+		free_composited_icon(c, ic);
 		XDestroyWindow(c->dpy, ic->embedder);
 	}
 	FREE_ARRAY(sw->icons);
@@ -182,8 +331,12 @@ static int create_widget_private(struct widget *w, struct config_format_entry *e
 
 	x_set_prop_int(c, sw->selection_owner, orientatom,
 		       NET_SYSTEM_TRAY_ORIENTATION_HORZ);
+	sw->composite = parse_bool("systray_composite", &g_settings.root) &&
+		c->composite;
 	x_set_prop_visualid(c, sw->selection_owner, visualatom,
-			    XVisualIDFromVisual(c->default_visual));
+			    XVisualIDFromVisual(sw->composite ?
+						c->argb_visual :
+						c->default_visual));
 
 	/* inform other clients that we're here */
 	XEvent ev;
@@ -236,23 +389,48 @@ static void panel_exposed(struct widget *w)
 {
 	struct systray_widget *sw = (struct systray_widget*)w->private;
 	struct systray_theme *st = &sw->theme;
-	struct x_connection *c = &w->panel->connection;
+	struct panel *p = w->panel;
+	struct x_connection *c = &p->connection;
 
 	size_t i;
-	int x = w->x + image_width(st->background.left) + st->icon_offset[0];
-	int y = (w->panel->height - st->icon_size[1]) / 2 + st->icon_offset[1];
+	int y = icon_y(w);
 	for (i = 0; i < sw->icons_n; ++i) {
-		XMoveResizeWindow(c->dpy, sw->icons[i].embedder, x, y,
-				  st->icon_size[0], st->icon_size[1]);
-		XResizeWindow(c->dpy, sw->icons[i].icon,
-			      st->icon_size[0], st->icon_size[1]);
-		if (!sw->icons[i].mapped) {
-			XMapRaised(c->dpy, sw->icons[i].embedder);
-			sw->icons[i].mapped = 1;
+		struct systray_icon *ic = &sw->icons[i];
+		int x = icon_x(w, i);
+		int moved = !ic->placed || ic->x != x || ic->y != y ||
+			ic->w != st->icon_size[0] || ic->h != st->icon_size[1];
+
+		/* touch only icons which were moved or which background was
+		 * changed, clearing forces a tray client to repaint
+		 */
+		if (!moved && (ic->composited ||
+			       ic->bg_generation == p->bg_generation))
+			continue;
+
+		if (moved) {
+			/* composite pixmap is reallocated on resize */
+			if (ic->w != st->icon_size[0] ||
+			    ic->h != st->icon_size[1])
+				release_icon_pixmap(c, ic);
+
+			XMoveResizeWindow(c->dpy, ic->embedder, x, y,
+					  st->icon_size[0], st->icon_size[1]);
+			XResizeWindow(c->dpy, ic->icon,
+				      st->icon_size[0], st->icon_size[1]);
+			ic->placed = 1;
+			ic->x = x;
+			ic->y = y;
+			ic->w = st->icon_size[0];
+			ic->h = st->icon_size[1];
 		}
-		XClearArea(c->dpy, sw->icons[i].icon, 0,0,0,0, True);
-
-		x += st->icon_size[0] + st->icon_spacing;
+		if (!ic->mapped) {
+			XMapRaised(c->dpy, ic->embedder);
+			ic->mapped = 1;
+		}
+		/* composited icons are painted by the panel (see damage_notify) */
+		if (!ic->composited)
+			XClearArea(c->dpy, ic->icon, 0,0,0,0, True);
+		ic->bg_generation = p->bg_generation;
 	}
 }
 
@@ -283,7 +461,46 @@ static void configure(struct widget *w, XConfigureEvent *e)
 	}
 }
 
-static void draw(struct widget *w)
+static void damage_notify(struct widget *w, Window win)
+{
+#ifdef HAVE_COMPOSITE
+	struct systray_widget *sw = (struct systray_widget*)w->private;
+	struct x_connection *c = &w->panel->connection;
+	size_t i;
+
+	for (i = 0; i < sw->icons_n; ++i) {
+		struct systray_icon *ic = &sw->icons[i];
+		if (ic->embedder != win || !ic->composited)
+			continue;
+
+		/* report the next change too */
+		XDamageSubtract(c->dpy, ic->damage, None, None);
+		ic->dirty = 1;
+		w->needs_partial_expose = 1;
+		return;
+	}
+#endif
+}
+
+static void add_event_routes(struct widget *w)
+{
+	struct systray_widget *sw = (struct systray_widget*)w->private;
+	struct x_connection *c = &w->panel->connection;
+	size_t i;
+
+	add_event_route(w, ClientMessage, sw->selection_owner,
+			c->atoms[XATOM_NET_SYSTEM_TRAY_OPCODE]);
+	for (i = 0; i < sw->icons_n; ++i) {
+		struct systray_icon *ic = &sw->icons[i];
+		add_event_route(w, DestroyNotify, ic->icon, None);
+		add_event_route(w, ConfigureNotify, ic->icon, None);
+		if (ic->composited)
+			add_event_route(w, damage_event_type(c), ic->embedder,
+					None);
+	}
+}
+
+static void draw_background(struct widget *w)
 {
 	struct systray_widget *sw = (struct systray_widget*)w->private;
 	struct systray_theme *st = &sw->theme;
@@ -316,6 +533,41 @@ static void draw(struct widget *w)
 	}
 }
 
+static void draw(struct widget *w)
+{
+	struct systray_widget *sw = (struct systray_widget*)w->private;
+	size_t i;
+
+	draw_background(w);
+	for (i = 0; i < sw->icons_n; ++i) {
+		struct systray_icon *ic = &sw->icons[i];
+		if (!ic->composited)
+			continue;
+		paint_composited_icon(w, ic, icon_x(w, i), icon_y(w));
+		ic->dirty = 0;
+	}
+}
+
+static void partial_draw(struct widget *w)
+{
+	struct systray_widget *sw = (struct systray_widget*)w->private;
+	struct systray_theme *st = &sw->theme;
+	size_t i;
+
+	for (i = 0; i < sw->icons_n; ++i) {
+		struct systray_icon *ic = &sw->icons[i];
+		if (!ic->dirty)
+			continue;
+
+		int x = icon_x(w, i);
+		begin_partial_expose(w, x, st->icon_size[0]);
+		draw_background(w);
+		paint_composited_icon(w, ic, x, icon_y(w));
+		end_partial_expose(w, x, st->icon_size[0]);
+		ic->dirty = 0;
+	}
+}
+
 static int retheme_reconfigure(struct widget *w, struct config_format_entry *e,
 			       struct config_format_tree *tree)
 {
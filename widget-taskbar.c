@@ -1,4 +1,6 @@
+#define XMALLOC_SOURCE msrc_taskbar
 #include <ctype.h>
+#include <time.h>
 #include "settings.h"
 #include "builtin-widgets.h"
 
@@ -6,10 +8,13 @@ static int create_widget_private(struct widget *w, struct config_format_entry *e
 		struct config_format_tree *tree);
 static void destroy_widget_private(struct widget *w);
 static void draw(struct widget *w);
+static void partial_draw(struct widget *w);
+static void expose_done(struct widget *w);
 static void button_click(struct widget *w, XButtonEvent *e);
 static void prop_change(struct widget *w, XPropertyEvent *e);
 static void client_msg(struct widget *w, XClientMessageEvent *e);
-static void configure(struct widget *w, XConfigureEvent *e);
+static void client_change(struct widget *w, unsigned int change, Window win);
+static void add_event_routes(struct widget *w);
 
 static void dnd_start(struct widget *w, struct drag_info *di);
 static void dnd_drag(struct widget *w, struct drag_info *di);
@@ -21,19 +26,25 @@ static void mouse_leave(struct widget *w);
 static void clock_tick(struct widget *w);
 static void reconfigure(struct widget *w);
 
+/* space between the overflow indicator text and its edges */
+#define TASKBAR_OVERFLOW_PADDING 4
+
 struct widget_interface taskbar_interface = {
 	.theme_name		= "taskbar",
 	.size_type		= WIDGET_SIZE_FILL,
 	.create_widget_private	= create_widget_private,
 	.destroy_widget_private = destroy_widget_private,
 	.draw			= draw,
+	.partial_draw		= partial_draw,
+	.expose_done		= expose_done,
 	.button_click		= button_click,
 	.prop_change		= prop_change,
 	.dnd_start		= dnd_start,
 	.dnd_drag		= dnd_drag,
 	.dnd_drop		= dnd_drop,
 	.client_msg		= client_msg,
-	.configure		= configure,
+	.client_change		= client_change,
+	.add_event_routes	= add_event_routes,
 	.mouse_motion		= mouse_motion,
 	.mouse_leave		= mouse_leave,
 	.clock_tick		= clock_tick,
@@ -75,21 +86,38 @@ static int parse_taskbar_state(struct taskbar_state *ts, const char *name,
 		return -1;
 	}
 
-	if (parse_triple_image(&ts->background, ee, tree, 1))
-		goto parse_taskbar_state_error_background;
-
 	if (parse_text_info_named(&ts->font, "font", ee, 1))
-		goto parse_taskbar_state_error_font;
+		return -1;
 
 	parse_2ints(ts->icon_offset, "icon_offset", ee);
 
 	ts->exists = 1;
+	if (is_lazy_theme_state(name)) {
+		ts->pending = ee;
+		ts->pending_tree = tree;
+		return 0;
+	}
+
+	if (parse_triple_image(&ts->background, ee, tree, 1)) {
+		free_text_info(&ts->font);
+		ts->exists = 0;
+		return -1;
+	}
 	return 0;
+}
 
-parse_taskbar_state_error_font:
-	free_triple_image(&ts->background);
-parse_taskbar_state_error_background:
-	return -1;
+/* parses images of a lazy state, returns false if the state doesn't exist */
+static int resolve_taskbar_state(struct taskbar_state *ts)
+{
+	if (ts->pending) {
+		struct config_format_entry *ee = ts->pending;
+		ts->pending = 0;
+		if (parse_triple_image(&ts->background, ee, ts->pending_tree, 1)) {
+			free_text_info(&ts->font);
+			ts->exists = 0;
+		}
+	}
+	return ts->exists;
 }
 
 static void free_taskbar_state(struct taskbar_state *ts)
@@ -121,6 +149,7 @@ static int parse_taskbar_theme(struct taskbar_theme *tt,
 
 	tt->separator = parse_image_part_named("separator", e, tree, 0);
 	tt->task_max_width = parse_int("task_max_width", e, 0);
+	tt->task_min_width = parse_int("task_min_width", e, 0);
 	tt->default_pinned = parse_bool( "default_pinned", e );
 
 	return 0;
@@ -194,6 +223,126 @@ static int find_task_by_window(struct taskbar_widget *tw, Window win)
 	return -1;
 }
 
+/* Task positions are calculated by "layout_tasks" and cached until
+ * something that affects them is changed (tasks array, visibility, widths).
+ */
+static inline void invalidate_task_layout(struct taskbar_widget *tw)
+{
+	tw->layout_valid = 0;
+}
+
+static void layout_tasks(struct widget *w);
+
+static int find_window(Window *wins, size_t wins_n, Window win)
+{
+	size_t i;
+	for (i = 0; i < wins_n; ++i) {
+		if (wins[i] == win)
+			return (int)i;
+	}
+	return -1;
+}
+
+static int is_same_group(struct taskbar_widget *tw, size_t i, size_t j)
+{
+	const char *a = tw->task_data[i].wm_class;
+	const char *b = tw->task_data[j].wm_class;
+	return a && b && !strcmp(a, b);
+}
+
+/* blinking is aligned to seconds, so blinks of all tasks share a wakeup */
+static void schedule_blink(struct widget *w)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	if (tw->task_urgency_hint && tw->urgent_n)
+		schedule_widget_tick(w, (get_time_ms() / 1000 + 1) * 1000);
+}
+
+static void set_task_urgency(struct widget *w, struct taskbar_task *t,
+			     int demands_attention)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	int i = find_window(tw->urgent, tw->urgent_n, t->win);
+
+	if (demands_attention) {
+		/* keep the blinking phase if it's already there */
+		if (!t->demands_attention)
+			t->demands_attention = 1;
+		if (i == -1) {
+			ARRAY_APPEND(tw->urgent, t->win);
+			schedule_blink(w);
+		}
+	} else {
+		t->demands_attention = 0;
+		if (i != -1)
+			ARRAY_REMOVE_UNORDERED(tw->urgent, (size_t)i);
+	}
+}
+
+/* repaint only that task button on the next expose */
+static void mark_task_dirty(struct widget *w, struct taskbar_task *t)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	if (w->needs_expose || t->needs_expose || !t->visible)
+		return;
+
+	/* positions are outdated, the whole widget will be redrawn */
+	if (!tw->layout_valid) {
+		w->needs_expose = 1;
+		return;
+	}
+
+	t->needs_expose = 1;
+	ARRAY_APPEND(tw->dirty, t->win);
+	w->needs_partial_expose = 1;
+}
+
+/* the task whose button shows the task "i", see "group_tasks" */
+static size_t group_button(struct taskbar_widget *tw, size_t i)
+{
+	size_t k;
+	if (!tw->task_grouping)
+		return i;
+
+	for (k = 0; k < tw->buttons_n; ++k) {
+		if (tw->buttons[k] == i || is_same_group(tw, tw->buttons[k], i))
+			return tw->buttons[k];
+	}
+	return i;
+}
+
+/* also repaints the group button, if the task is hidden in a group */
+static void mark_button_dirty(struct widget *w, struct taskbar_task *t)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	size_t i = (size_t)(t - tw->tasks);
+	size_t button = group_button(tw, i);
+
+	mark_task_dirty(w, t);
+	if (button != i)
+		mark_task_dirty(w, &tw->tasks[button]);
+}
+
+/* a group button blinks if any of its windows demands attention */
+static int group_attention(struct taskbar_widget *tw, size_t i)
+{
+	int attention = tw->tasks[i].demands_attention;
+	size_t k;
+
+	if (!tw->task_grouping || tw->task_data[i].group_n < 2)
+		return attention;
+
+	for (k = 0; k < tw->urgent_n; ++k) {
+		int ti = find_task_by_window(tw, tw->urgent[k]);
+		if (ti == -1 || !tw->tasks[ti].visible ||
+		    !is_same_group(tw, (size_t)ti, i))
+			continue;
+		if (tw->tasks[ti].demands_attention > attention)
+			attention = tw->tasks[ti].demands_attention;
+	}
+	return attention;
+}
+
 static int find_last_task_by_desktop(struct taskbar_widget *tw, int desktop)
 {
 	int t = -1;
@@ -205,108 +354,238 @@ static int find_last_task_by_desktop(struct taskbar_widget *tw, int desktop)
 	return t;
 }
 
-static void add_task(struct widget *w, struct x_connection *c, Window win)
+static int client_monitor(struct widget *w, struct ewmh_client *cc)
+{
+	struct x_connection *c = &w->panel->connection;
+	int x, y, width, height;
+
+	/* do not fetch geometry if there is only one monitor */
+	if (c->monitors_n == 1)
+		return 0;
+
+	ewmh_client_geometry(&w->panel->clients, cc, &x, &y, &width, &height);
+	return task_monitor(x, y, width, height, c->monitors, c->monitors_n);
+}
+
+/* The "visible" list is changed along with the tasks array, desktop and
+ * monitors, so layout and drawing don't check visibility of every task.
+ */
+static void rebuild_visible_tasks(struct widget *w)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	size_t i;
+
+	CLEAR_ARRAY(tw->visible);
+	for (i = 0; i < tw->tasks_n; ++i) {
+		struct taskbar_task *t = &tw->tasks[i];
+		t->visible = is_task_visible(w, t);
+		if (t->visible)
+			ARRAY_APPEND(tw->visible, i);
+	}
+	invalidate_task_layout(tw);
+}
+
+/* adds the task "i" to the list if it's visible, the list must not contain
+ * it already */
+static void show_visible_task(struct widget *w, size_t i)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	struct taskbar_task *t = &tw->tasks[i];
+
+	t->visible = is_task_visible(w, t);
+	if (!t->visible)
+		return;
+
+	size_t j;
+	for (j = 0; j < tw->visible_n; ++j) {
+		if (tw->visible[j] > i)
+			break;
+	}
+	if (j == tw->visible_n)
+		ARRAY_APPEND(tw->visible, i);
+	else
+		ARRAY_INSERT_BEFORE(tw->visible, j, i);
+	invalidate_task_layout(tw);
+}
+
+static void hide_visible_task(struct widget *w, size_t i)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	size_t j;
+
+	if (!tw->tasks[i].visible)
+		return;
+
+	tw->tasks[i].visible = 0;
+	for (j = 0; j < tw->visible_n; ++j) {
+		if (tw->visible[j] == i) {
+			ARRAY_REMOVE(tw->visible, j);
+			break;
+		}
+	}
+	invalidate_task_layout(tw);
+}
+
+/* re-evaluates visibility of the task "i" after its desktop or monitor was
+ * changed */
+static void update_task_visibility(struct widget *w, size_t i)
+{
+	hide_visible_task(w, i);
+	show_visible_task(w, i);
+}
+
+/* inserts a task before "i", "i" may be equal to the number of tasks */
+static void insert_task(struct widget *w, size_t i,
+			struct taskbar_task *t, struct taskbar_task_data *td)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	size_t j;
+
+	if (i == tw->tasks_n) {
+		ARRAY_APPEND(tw->tasks, *t);
+		ARRAY_APPEND(tw->task_data, *td);
+	} else {
+		ARRAY_INSERT_BEFORE(tw->tasks, i, *t);
+		ARRAY_INSERT_BEFORE(tw->task_data, i, *td);
+	}
+
+	for (j = 0; j < tw->visible_n; ++j) {
+		if (tw->visible[j] >= i)
+			tw->visible[j]++;
+	}
+	tw->tasks[i].visible = 0;
+	show_visible_task(w, i);
+	invalidate_task_layout(tw);
+}
+
+static void remove_task_at(struct widget *w, size_t i)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	size_t j;
+
+	hide_visible_task(w, i);
+	for (j = 0; j < tw->visible_n; ++j) {
+		if (tw->visible[j] > i)
+			tw->visible[j]--;
+	}
+
+	ARRAY_REMOVE(tw->tasks, i);
+	ARRAY_REMOVE(tw->task_data, i);
+	invalidate_task_layout(tw);
+}
+
+static void add_task(struct widget *w, struct x_connection *c,
+		     struct ewmh_client *cc)
 {
 	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
 	struct taskbar_task t;
+	struct taskbar_task_data td;
+	Window win = cc->win;
 
+	/* the client model watches the window, we'll know if it will appear
+	 * later
+	 */
 	x_set_error_trap();
 	if (!x_is_window_visible_on_panel(c, win)) {
-		if (x_done_error_trap())
-			return;
-		// we need this if window will apear later
-		if (w->panel->win != win)
-			XSelectInput(c->dpy, win, PropertyChangeMask);
+		x_done_error_trap();
 		return;
 	}
 
-
-	XWindowAttributes winattrs;
-	XGetWindowAttributes(c->dpy, win, &winattrs);
-	long mask = winattrs.your_event_mask | PropertyChangeMask | StructureNotifyMask;
-	XSelectInput(c->dpy, win, mask);
-	XGetWindowAttributes(c->dpy, win, &winattrs); /* get position after select input */
-
 	CLEAR_STRUCT(&t);
+	CLEAR_STRUCT(&td);
 	t.win = win;
-	t.demands_attention = x_is_window_demands_attention(c, win);
-	int x, y;
-	x_translate_coordinates(c, 0, 0, &x, &y, win);
-	t.monitor = task_monitor(x, y, winattrs.width, winattrs.height,
-				 c->monitors, c->monitors_n);
+	t.monitor = client_monitor(w, cc);
+
+	x_realloc_window_name(&td.name, c, win, &td.name_atom, &td.name_type_atom);
+
+	XClassHint ch;
+	if (XGetClassHint(c->dpy, win, &ch)) {
+		if (ch.res_name)
+			XFree(ch.res_name);
+		if (ch.res_class) {
+			td.wm_class = xstrdup(ch.res_class);
+			XFree(ch.res_class);
+		}
+	}
 
-	x_realloc_window_name(&t.name, c, win, &t.name_atom, &t.name_type_atom);
 	if (tw->theme.default_icon)
-		t.icon = get_window_icon(c, win, tw->theme.default_icon);
+		td.icon = get_window_icon(c, win, td.wm_class,
+					  tw->theme.default_icon);
 	else
-		t.icon = 0;
-	t.desktop = x_get_window_desktop(c, win);
+		td.icon = 0;
+	t.desktop = cc->desktop;
 
 	t.pinned = tw->theme.default_pinned;
 
-	int i = find_last_task_by_desktop(tw, t.desktop);
-	if (i == -1)
-		ARRAY_PREPEND(tw->tasks, t);
-	else
-		ARRAY_INSERT_AFTER(tw->tasks, (size_t)i, t);
+	size_t i = find_last_task_by_desktop(tw, t.desktop) + 1;
+	insert_task(w, i, &t, &td);
+
+	add_event_route(w, PropertyNotify, win, None);
+
+	if (x_is_window_demands_attention(c, win))
+		set_task_urgency(w, &tw->tasks[i], 1);
+	x_done_error_trap();
 }
 
-static void free_task(struct taskbar_task *t)
+static void free_task_data(struct taskbar_task_data *td)
 {
-	strbuf_free(&t->name);
-	if (t->icon)
-		cairo_surface_destroy(t->icon);
+	strbuf_free(&td->name);
+	if (td->wm_class)
+		xfree(td->wm_class);
+	if (td->icon)
+		cairo_surface_destroy(td->icon);
 }
 
-static void remove_task(struct taskbar_widget *tw, size_t i)
+static void remove_task(struct widget *w, size_t i)
 {
-	free_task(&tw->tasks[i]);
-	ARRAY_REMOVE(tw->tasks, i);
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	remove_event_routes(w, tw->tasks[i].win);
+
+	int ui = find_window(tw->urgent, tw->urgent_n, tw->tasks[i].win);
+	if (ui != -1)
+		ARRAY_REMOVE_UNORDERED(tw->urgent, (size_t)ui);
+	int pi = find_window(tw->pending_names, tw->pending_names_n,
+			     tw->tasks[i].win);
+	if (pi != -1)
+		ARRAY_REMOVE_UNORDERED(tw->pending_names, (size_t)pi);
+
+	free_task_data(&tw->task_data[i]);
+	remove_task_at(w, i);
 }
 
 static void free_tasks(struct taskbar_widget *tw)
 {
 	size_t i;
-	for (i = 0; i < tw->tasks_n; ++i)
-		free_task(&tw->tasks[i]);
+	for (i = 0; i < tw->task_data_n; ++i)
+		free_task_data(&tw->task_data[i]);
 	FREE_ARRAY(tw->tasks);
-}
-
-static int count_visible_tasks(struct widget *w)
-{
-	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
-	int count = 0;
-	size_t i;
-	for (i = 0; i < tw->tasks_n; ++i) {
-		if (is_task_visible(w, &tw->tasks[i]))
-			count++;
-	}
-	return count;
+	FREE_ARRAY(tw->task_data);
 }
 
 static int highlighted_state_exists(struct taskbar_theme *theme, int active)
 {
 	int state_hl = (active << 1) | 1;
-	if (theme->states[state_hl].exists)
-		return 1;
-	return 0;
+	return resolve_taskbar_state(&theme->states[state_hl]);
 }
 
-static void draw_task(struct taskbar_task *task, struct taskbar_widget *tw,
-		cairo_t *cr, PangoLayout *layout, int x, int w, int active,
-		int highlighted)
+static void draw_task(struct taskbar_task *task, struct taskbar_task_data *td,
+		struct taskbar_widget *tw, cairo_t *cr, PangoLayout *layout,
+		int x, int w, int active, int highlighted)
 {
 	struct taskbar_theme *theme = &tw->theme;
 
 	if (tw->task_urgency_hint) {
+		int attention = 0;
 		if (active)
 			task->demands_attention = 0;
+		else
+			attention = group_attention(tw, (size_t)(task - tw->tasks));
 
-		if (task->demands_attention > 0) {
+		if (attention > 0) {
 			if (highlighted_state_exists(theme, active))
-				highlighted = task->demands_attention - 1;
+				highlighted = attention - 1;
 			else
-				active = task->demands_attention - 1;
+				active = attention - 1;
 		}
 	}
 
@@ -317,7 +596,7 @@ static void draw_task(struct taskbar_task *task, struct taskbar_widget *tw,
 	struct triple_image *tbt;
 	struct text_info *font;
 	int *icon_offset;
-	if (theme->states[state_hl].exists) {
+	if (resolve_taskbar_state(&theme->states[state_hl])) {
 		tbt = &theme->states[state_hl].background;
 		font = &theme->states[state_hl].font;
 		icon_offset = theme->states[state_hl].icon_offset;
@@ -363,14 +642,22 @@ static void draw_task(struct taskbar_task *task, struct taskbar_widget *tw,
 		yy += icon_offset[1];
 		cairo_save(cr);
 		cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
-		blit_image(task->icon, cr, xx, yy);
+		blit_image(td->icon, cr, xx, yy);
 		cairo_restore(cr);
 	}
 	xx += iconw;
 
-	/* text */
-	if ( !task->pinned )
-		draw_text(cr, layout, font, task->name.buf, xx, 0, textw, height, 1);
+	/* text, a group has the number of windows in front */
+	if (task->pinned)
+		return;
+
+	if (tw->task_grouping && td->group_n > 1) {
+		char buf[MAX_ALLOCA];
+		snprintf(buf, sizeof(buf), "[%d] %s", td->group_n, td->name.buf);
+		draw_text(cr, layout, font, buf, xx, 0, textw, height, 1);
+	} else {
+		draw_text(cr, layout, font, td->name.buf, xx, 0, textw, height, 1);
+	}
 }
 
 static inline void activate_task(struct x_connection *c, struct taskbar_task *t)
@@ -389,82 +676,49 @@ static inline void close_task(struct x_connection *c, struct taskbar_task *t)
 			CurrentTime, 2, 0, 0, 0);
 }
 
-static void move_task(struct taskbar_widget *tw, int what, int where)
+static void move_task(struct widget *w, int what, int where)
 {
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
 	struct taskbar_task t = tw->tasks[what];
+	struct taskbar_task_data td = tw->task_data[what];
 	if (what == where)
 		return;
-	ARRAY_REMOVE(tw->tasks, (size_t)what);
-	if (where > what) {
-		where -= 1;
-		ARRAY_INSERT_AFTER(tw->tasks, (size_t)where, t);
-	} else {
-		ARRAY_INSERT_BEFORE(tw->tasks, (size_t)where, t);
-	}
+	remove_task_at(w, (size_t)what);
+	insert_task(w, (size_t)where, &t, &td);
 }
 
 static int get_taskbar_task_at(struct widget *w, int x)
 {
 	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	layout_tasks(w);
 
-	size_t i;
-	for (i = 0; i < tw->tasks_n; ++i) {
-		struct taskbar_task *t = &tw->tasks[i];
-		if (!is_task_visible(w, t))
-			continue;
-
-		if (x < (t->x + t->w) && x > t->x)
-			return (int)i;
-	}
-	return -1;
+	return find_span(tw->spans, tw->spans_n, x);
 }
 
 /**************************************************************************
   Updates
 **************************************************************************/
 
-static void update_active(struct taskbar_widget *tw, struct x_connection *c)
+static void update_active(struct widget *w)
 {
-	tw->active = x_get_prop_window(c, c->root,
-			c->atoms[XATOM_NET_ACTIVE_WINDOW]);
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	tw->active = w->panel->clients.active;
+	invalidate_task_layout(tw); /* pinned tasks width depends on state */
 }
 
-static void update_desktop(struct taskbar_widget *tw, struct x_connection *c)
+static void update_desktop(struct widget *w)
 {
-	tw->desktop = x_get_prop_int(c, c->root,
-			c->atoms[XATOM_NET_CURRENT_DESKTOP]);
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	tw->desktop = w->panel->clients.current_desktop;
+	rebuild_visible_tasks(w);
 }
 
 static void update_tasks(struct widget *w, struct x_connection *c)
 {
-	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
-	Window *wins;
-	int num;
-
-	wins = x_get_prop_data(c, c->root, c->atoms[XATOM_NET_CLIENT_LIST],
-			XA_WINDOW, &num);
-
+	struct ewmh_clients *cl = &w->panel->clients;
 	size_t i;
-	int j;
-	for (i = 0; i < tw->tasks_n; ++i) {
-		struct taskbar_task *t = &tw->tasks[i];
-		int delete = 1;
-		for (j = 0; j < num; ++j) {
-			if (wins[j] == t->win) {
-				delete = 0;
-				break;
-			}
-		}
-		if (delete)
-			remove_task(tw, i--);
-	}
-
-	for (j = 0; j < num; ++j) {
-		if (find_task_by_window(tw, wins[j]) == -1)
-			add_task(w, c, wins[j]);
-	}
-
-	XFree(wins);
+	for (i = 0; i < cl->clients_n; ++i)
+		add_task(w, c, &cl->clients[i]);
 }
 
 /**************************************************************************
@@ -482,23 +736,33 @@ static int create_widget_private(struct widget *w, struct config_format_entry *e
 	}
 
 	INIT_ARRAY(tw->tasks, 50);
+	INIT_ARRAY(tw->task_data, 50);
+	INIT_ARRAY(tw->visible, 50);
+	INIT_EMPTY_ARRAY(tw->buttons);
+	INIT_ARRAY(tw->spans, 50);
+	INIT_EMPTY_ARRAY(tw->urgent);
+	INIT_EMPTY_ARRAY(tw->dirty);
+	INIT_EMPTY_ARRAY(tw->pending_names);
 	w->private = tw;
 
 	struct x_connection *c = &w->panel->connection;
-	update_desktop(tw, c);
-	update_active(tw, c);
-	update_tasks(w, c);
+	update_desktop(w);
+	update_active(w);
 	tw->dnd_win = None;
 	tw->taken = None;
 	tw->task_death_threshold = parse_int("task_death_threshold",
 					     &g_settings.root, 50);
 	tw->task_urgency_hint = parse_bool("task_urgency_hint",
 					   &g_settings.root);
+	tw->task_title_rate = parse_int("task_title_rate",
+					&g_settings.root, 4);
+	tw->task_grouping = parse_bool("task_grouping", &g_settings.root);
 	const char *tvmstr = find_config_format_entry_value(&g_settings.root,
 							    "task_visible_monitors");
 	tw->task_visible_monitors = parse_task_visible_monitors(tvmstr);
 	tw->dnd_cur = XCreateFontCursor(c->dpy, XC_fleur);
 	tw->highlighted = -1;
+	update_tasks(w, c);
 
 	return 0;
 }
@@ -508,39 +772,208 @@ static void destroy_widget_private(struct widget *w)
 	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
 	free_taskbar_theme(&tw->theme);
 	free_tasks(tw);
+	FREE_ARRAY(tw->spans);
+	FREE_ARRAY(tw->visible);
+	FREE_ARRAY(tw->buttons);
+	FREE_ARRAY(tw->urgent);
+	FREE_ARRAY(tw->dirty);
+	FREE_ARRAY(tw->pending_names);
 	XFreeCursor(w->panel->connection.dpy, tw->dnd_cur);
 	xfree(tw);
 }
 
-static void draw(struct widget *w)
+/* Fetches a changed name, but not more often than "task_title_rate" times
+ * per second, a burst of changes results in one fetch. Returns false if the
+ * name is still pending until "name_next_update".
+ */
+static int update_task_name(struct widget *w, size_t i)
 {
-	/* I think it's a good idea to calculate all buttons positions here, and
-	 * cache these data for later use in other message handlers. User
-	 * interacts with what he/she sees, right?
-	 */
 	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
-	struct panel *p = w->panel;
-	struct x_connection *c = &p->connection;
-	cairo_t *cr = p->cr;
+	struct x_connection *c = &w->panel->connection;
+	struct taskbar_task *t = &tw->tasks[i];
+	struct taskbar_task_data *td = &tw->task_data[i];
 
-	int count = count_visible_tasks(w);
-	if (!count)
+	if (!t->name_pending)
+		return 1;
+
+	int64_t now = get_time_ms();
+	if (td->name_next_update > now)
+		return 0;
+
+	x_realloc_window_name(&td->name, c, t->win,
+			      &td->name_atom, &td->name_type_atom);
+	t->name_pending = 0;
+	if (tw->task_title_rate > 0)
+		td->name_next_update = now + 1000 / tw->task_title_rate;
+	mark_task_dirty(w, t);
+	return 1;
+}
+
+/* Fills "buttons" with one task per WM_CLASS: the active window of a group
+ * or its first window. The button takes the place of the first window.
+ */
+static void group_tasks(struct widget *w)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	size_t i, j, k;
+
+	CLEAR_ARRAY(tw->buttons);
+	for (j = 0; j < tw->visible_n; ++j) {
+		i = tw->visible[j];
+		for (k = 0; k < tw->buttons_n; ++k) {
+			if (is_same_group(tw, tw->buttons[k], i))
+				break;
+		}
+		if (k == tw->buttons_n) {
+			tw->task_data[i].group_n = 1;
+			ARRAY_APPEND(tw->buttons, i);
+			continue;
+		}
+
+		size_t leader = tw->buttons[k];
+		int group_n = tw->task_data[leader].group_n + 1;
+		if (tw->tasks[i].win == tw->active) {
+			tw->task_data[leader].group_n = 1;
+			tw->buttons[k] = leader = i;
+		}
+		tw->task_data[leader].group_n = group_n;
+	}
+}
+
+/* the task to activate on a click: the next window of the group if the
+ * active one is there, -1 if the task is not a group */
+static int next_group_task(struct widget *w, size_t ti)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	size_t j, k;
+
+	if (!tw->task_grouping || tw->task_data[ti].group_n < 2)
+		return -1;
+	if (tw->tasks[ti].win != tw->active)
+		return (int)ti;
+
+	for (j = 0; j < tw->visible_n; ++j) {
+		if (tw->visible[j] == ti)
+			break;
+	}
+	for (k = 1; k < tw->visible_n; ++k) {
+		size_t i = tw->visible[(j + k) % tw->visible_n];
+		if (is_same_group(tw, i, ti))
+			return (int)i;
+	}
+	return -1;
+}
+
+static int overflow_indicator_width(struct widget *w, int pages)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	char buf[64];
+	int textw;
+
+	snprintf(buf, sizeof(buf), "< %d/%d >", pages, pages);
+	text_extents(w->panel->layout, tw->theme.states[BUTTON_STATE_IDLE].font.pfd,
+		     buf, &textw, 0);
+	return textw + 2 * TASKBAR_OVERFLOW_PADDING;
+}
+
+/* Splits visible tasks to pages if they don't fit with "task_min_width",
+ * returns true if there is more than one page. The page follows the active
+ * task, unless it was scrolled since the last activation.
+ */
+static int layout_pages(struct widget *w, size_t *list, size_t list_n)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	int count = (int)list_n;
+	int minw = tw->theme.task_min_width;
+	int sepw = image_width(tw->theme.separator);
+
+	if (!minw || count * (minw + sepw) - sepw <= w->width)
+		return 0;
+
+	tw->overflow_w = overflow_indicator_width(w, count);
+	int per_page = (w->width - tw->overflow_w + sepw) / (minw + sepw);
+	if (per_page < 1)
+		per_page = 1;
+	tw->pages = (count + per_page - 1) / per_page;
+	/* even the tasks out between the pages */
+	per_page = (count + tw->pages - 1) / tw->pages;
+
+	if (tw->page_active != tw->active) {
+		size_t j;
+		for (j = 0; j < list_n; ++j) {
+			if (tw->tasks[list[j]].win == tw->active) {
+				tw->page = (int)j / per_page;
+				tw->page_active = tw->active;
+				break;
+			}
+		}
+	}
+	if (tw->page >= tw->pages)
+		tw->page = tw->pages - 1;
+	tw->overflow_x = w->x + w->width - tw->overflow_w;
+	return 1;
+}
+
+static void layout_tasks(struct widget *w)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+
+	if (tw->layout_valid && tw->layout_x == w->x &&
+	    tw->layout_width == w->width)
 		return;
 
-	size_t i;
+	tw->layout_valid = 1;
+	tw->layout_x = w->x;
+	tw->layout_width = w->width;
+	CLEAR_ARRAY(tw->spans);
+	tw->pages = 1;
+	tw->overflow_w = 0;
+
+	size_t i, j;
 	struct taskbar_task *t;
 	int pinnedtw = 0;
 	int pinnedc = 0;
 
+	/* tasks which are not laid out (other pages, grouped windows) have
+	 * zero width */
+	for (j = 0; j < tw->visible_n; ++j)
+		tw->tasks[tw->visible[j]].w = 0;
+
+	size_t *list = tw->visible;
+	size_t list_n = tw->visible_n;
+	if (tw->task_grouping) {
+		group_tasks(w);
+		list = tw->buttons;
+		list_n = tw->buttons_n;
+	}
+
+	int count = (int)list_n;
+	if (!count)
+		return;
+
+	/* overflow: only a page of tasks is laid out */
+	size_t first = 0, last = list_n;
+	int width = w->width;
+	if (layout_pages(w, list, list_n)) {
+		int per_page = (count + tw->pages - 1) / tw->pages;
+		width -= tw->overflow_w;
+		first = tw->page * per_page;
+		last = first + per_page;
+		if (last > list_n)
+			last = list_n;
+		count = (int)(last - first);
+	}
+
 	// First calculate the pinned task width
-	for (i = 0; i < tw->tasks_n; ++i) {
+	for (j = first; j < last; ++j) {
+		i = list[j];
 		t = &tw->tasks[i];
 
-		if ( is_task_visible(w, t) && t->pinned ) {
+		if ( t->pinned ) {
 			int state = (t->win == tw->active) << 1;
 			int state_hl = state | (i == tw->highlighted);
 			struct triple_image *tbt;
-			if (tw->theme.states[state_hl].exists) {
+			if (resolve_taskbar_state(&tw->theme.states[state_hl])) {
 				tbt = &tw->theme.states[state_hl].background;
 			} else {
 				tbt = &tw->theme.states[state].background;
@@ -565,7 +998,7 @@ static void draw(struct widget *w)
 		taskcount = 1;
 	}
 
-	int taskw = (w->width - sepspace - pinnedtw) / taskcount;
+	int taskw = (width - sepspace - pinnedtw) / taskcount;
 	if (tw->theme.task_max_width && taskw > tw->theme.task_max_width)
 		taskw = tw->theme.task_max_width;
 
@@ -573,16 +1006,14 @@ static void draw(struct widget *w)
 	int ttaskw;
 	int curtask = 0;
 
-	for (i = 0; i < tw->tasks_n; ++i) {
+	for (j = first; j < last; ++j) {
+		i = list[j];
 		t = &tw->tasks[i];
 
-		if (!is_task_visible(w, t))
-			continue;
-
 #define TASKS_NEED_CORRECTION (taskw != tw->theme.task_max_width)
 		/* last task width correction */
 		if (TASKS_NEED_CORRECTION && curtask == count-1)
-			taskw = (w->x + w->width) - x;
+			taskw = (w->x + width) - x;
 
 		if (tw->theme.task_max_width && taskw > tw->theme.task_max_width)
 			taskw = tw->theme.task_max_width;
@@ -597,121 +1028,371 @@ static void draw(struct widget *w)
 		/* save position for other events */
 		t->x = x;
 		t->w = taskw;
+		if (tw->task_data[i].geom_x != t->x ||
+		    tw->task_data[i].geom_w != t->w)
+			tw->geom_dirty = 1;
 
-		/* set icon geometry */
-		if (t->geom_x != t->x || t->geom_w != t->w) {
-			t->geom_x = t->x;
-			t->geom_w = t->w;
-
-			long icon_geometry[4] = {
-				w->panel->x + t->x,
-				w->panel->y,
-				t->w,
-				w->panel->width
-			};
-			x_set_prop_array(c, t->win, c->atoms[XATOM_NET_WM_ICON_GEOMETRY],
-					 icon_geometry, 4);
-		}
+		struct span sp = {t->x, t->w, (int)i};
+		ARRAY_APPEND(tw->spans, sp);
 
-		draw_task(t, tw, cr, w->panel->layout,
-			  x, taskw, t->win == tw->active, i == tw->highlighted);
 		x += taskw;
-		if (sepspace && curtask != count-1) {
-			blit_image(tw->theme.separator, cr, x, 0);
+		if (sepspace && curtask != count-1)
 			x += image_width(tw->theme.separator);
-		}
 		curtask++;
 
 		taskw = ttaskw;
 	}
 }
 
+/* blink phase of urgent tasks on other pages, zero if there are none */
+static int offpage_attention(struct taskbar_widget *tw)
+{
+	int attention = 0;
+	size_t k;
+
+	if (!tw->task_urgency_hint || tw->pages < 2)
+		return 0;
+
+	for (k = 0; k < tw->urgent_n; ++k) {
+		int ti = find_task_by_window(tw, tw->urgent[k]);
+		if (ti == -1 || !tw->tasks[ti].visible)
+			continue;
+		/* laid out tasks and groups have a button on this page */
+		if (tw->tasks[group_button(tw, (size_t)ti)].w)
+			continue;
+		if (tw->tasks[ti].demands_attention > attention)
+			attention = tw->tasks[ti].demands_attention;
+	}
+	return attention;
+}
+
+/* repaint only the overflow indicator on the next expose */
+static void mark_overflow_dirty(struct widget *w)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	if (w->needs_expose || tw->overflow_dirty)
+		return;
+
+	if (!tw->layout_valid) {
+		w->needs_expose = 1;
+		return;
+	}
+
+	tw->overflow_dirty = 1;
+	w->needs_partial_expose = 1;
+}
+
+static void update_overflow_attention(struct widget *w)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	if (tw->layout_valid && offpage_attention(tw) != tw->overflow_attention)
+		mark_overflow_dirty(w);
+}
+
+/* the indicator blinks with the pressed state while an urgent task is on
+ * another page */
+static void draw_overflow_indicator(struct widget *w)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	struct taskbar_state *ts = &tw->theme.states[BUTTON_STATE_IDLE];
+	char buf[64];
+
+	tw->overflow_attention = offpage_attention(tw);
+	if (tw->overflow_attention == 2) {
+		ts = &tw->theme.states[BUTTON_STATE_PRESSED];
+		pattern_image(ts->background.center, w->panel->cr,
+			      tw->overflow_x, 0, tw->overflow_w, 1);
+	}
+
+	snprintf(buf, sizeof(buf), "%s %d/%d %s",
+		 tw->page > 0 ? "<" : " ", tw->page + 1, tw->pages,
+		 tw->page < tw->pages - 1 ? ">" : " ");
+	draw_text(w->panel->cr, w->panel->layout, &ts->font, buf,
+		  tw->overflow_x + TASKBAR_OVERFLOW_PADDING, 0,
+		  tw->overflow_w - 2 * TASKBAR_OVERFLOW_PADDING,
+		  image_height(ts->background.center), 0);
+}
+
+static void draw(struct widget *w)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	cairo_t *cr = w->panel->cr;
+
+	/* everything is repainted, dirty set is useless */
+	size_t i;
+	for (i = 0; i < tw->dirty_n; ++i) {
+		int ti = find_task_by_window(tw, tw->dirty[i]);
+		if (ti != -1)
+			tw->tasks[ti].needs_expose = 0;
+	}
+	CLEAR_ARRAY(tw->dirty);
+	tw->overflow_dirty = 0;
+	tw->overflow_attention = 0;
+
+	layout_tasks(w);
+
+	for (i = 0; i < tw->spans_n; ++i) {
+		int ti = tw->spans[i].index;
+		struct taskbar_task *t = &tw->tasks[ti];
+
+		draw_task(t, &tw->task_data[ti], tw, cr, w->panel->layout,
+			  t->x, t->w, t->win == tw->active,
+			  ti == tw->highlighted);
+		if (tw->theme.separator && i != tw->spans_n - 1)
+			blit_image(tw->theme.separator, cr, t->x + t->w, 0);
+	}
+
+	if (tw->pages > 1)
+		draw_overflow_indicator(w);
+}
+
+static void partial_draw(struct widget *w)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	cairo_t *cr = w->panel->cr;
+
+	/* tasks were moved since they were marked, redraw everything */
+	if (!tw->layout_valid) {
+		w->needs_expose = 1;
+		return;
+	}
+
+	size_t i;
+	for (i = 0; i < tw->dirty_n; ++i) {
+		int ti = find_task_by_window(tw, tw->dirty[i]);
+		if (ti == -1)
+			continue;
+
+		struct taskbar_task *t = &tw->tasks[ti];
+		t->needs_expose = 0;
+		if (!t->visible || !t->w)
+			continue;
+
+		begin_partial_expose(w, t->x, t->w);
+		draw_task(t, &tw->task_data[ti], tw, cr, w->panel->layout,
+			  t->x, t->w, t->win == tw->active, ti == tw->highlighted);
+		end_partial_expose(w, t->x, t->w);
+	}
+	CLEAR_ARRAY(tw->dirty);
+
+	if (tw->overflow_dirty) {
+		tw->overflow_dirty = 0;
+		tw->overflow_attention = 0;
+		if (tw->pages > 1) {
+			begin_partial_expose(w, tw->overflow_x, tw->overflow_w);
+			draw_overflow_indicator(w);
+			end_partial_expose(w, tw->overflow_x, tw->overflow_w);
+		}
+	}
+}
+
+/* _NET_WM_ICON_GEOMETRY is sent for all moved tasks at once, after the
+ * frame is shown
+ */
+static void expose_done(struct widget *w)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	struct panel *p = w->panel;
+	struct x_connection *c = &p->connection;
+
+	if (!tw->geom_dirty)
+		return;
+
+	size_t i;
+	for (i = 0; i < tw->spans_n; ++i) {
+		struct taskbar_task *t = &tw->tasks[tw->spans[i].index];
+		struct taskbar_task_data *td = &tw->task_data[tw->spans[i].index];
+		if (td->geom_x == t->x && td->geom_w == t->w)
+			continue;
+
+		td->geom_x = t->x;
+		td->geom_w = t->w;
+
+		long icon_geometry[4] = {
+			p->x + t->x,
+			p->y,
+			t->w,
+			p->width
+		};
+		x_set_prop_array(c, t->win, c->atoms[XATOM_NET_WM_ICON_GEOMETRY],
+				 icon_geometry, 4);
+	}
+	tw->geom_dirty = 0;
+}
+
 static void prop_change(struct widget *w, XPropertyEvent *e)
 {
 	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
 	struct x_connection *c = &w->panel->connection;
 
-	/* root window props */
-	if (e->window == c->root) {
-		if (e->atom == c->atoms[XATOM_NET_ACTIVE_WINDOW]) {
-			update_active(tw, c);
+	/* check if it's our task */
+	int ti = find_task_by_window(tw, e->window);
+	if (ti == -1)
+		return;
+
+	/* task name was changed, it's fetched now or on the next tick */
+	struct taskbar_task_data *td = &tw->task_data[ti];
+	if (e->atom == td->name_atom)
+	{
+		struct taskbar_task *t = &tw->tasks[ti];
+		int pending = t->name_pending;
+		t->name_pending = 1;
+		if (!update_task_name(w, (size_t)ti)) {
+			if (!pending)
+				ARRAY_APPEND(tw->pending_names, t->win);
+			schedule_widget_tick(w, td->name_next_update);
+		}
+		return;
+	}
+
+	/* icon was changed */
+	if (tw->theme.default_icon) {
+		if (e->atom == c->atoms[XATOM_NET_WM_ICON] ||
+		    e->atom == XA_WM_HINTS)
+		{
+			cairo_surface_destroy(td->icon);
+			td->icon = get_window_icon(c, e->window, td->wm_class,
+						   tw->theme.default_icon);
 			w->needs_expose = 1;
 			return;
 		}
-		if (e->atom == c->atoms[XATOM_NET_CURRENT_DESKTOP]) {
-			update_desktop(tw, c);
+	}
+}
+
+static void client_change(struct widget *w, unsigned int change, Window win)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	struct x_connection *c = &w->panel->connection;
+	struct ewmh_client *cc;
+	int ti;
+
+	switch (change) {
+	case EWMH_ACTIVE_WINDOW:
+		update_active(w);
+		w->needs_expose = 1;
+		return;
+	case EWMH_CURRENT_DESKTOP:
+		update_desktop(w);
+		w->needs_expose = 1;
+		return;
+	case EWMH_CLIENT_ADDED:
+		cc = ewmh_find_client(&w->panel->clients, win);
+		if (cc) {
+			add_task(w, c, cc);
 			w->needs_expose = 1;
-			return;
 		}
-		if (e->atom == c->atoms[XATOM_NET_CLIENT_LIST]) {
-			update_tasks(w, c);
+		return;
+	case EWMH_CLIENT_REMOVED:
+		ti = find_task_by_window(tw, win);
+		if (ti != -1) {
+			remove_task(w, ti);
 			w->needs_expose = 1;
-			return;
 		}
+		return;
+	default:
+		break;
 	}
 
-	/* check if it's our task */
-	int ti = find_task_by_window(tw, e->window);
+	cc = ewmh_find_client(&w->panel->clients, win);
+	if (!cc)
+		return;
+
+	ti = find_task_by_window(tw, win);
 	if (ti == -1) {
-		if (e->atom == c->atoms[XATOM_NET_WM_STATE] ||
-		    e->atom == c->atoms[XATOM_NET_WM_WINDOW_TYPE]) {
-			add_task(w, c, e->window);
+		/* window may become visible on the panel */
+		if (change == EWMH_CLIENT_STATE) {
+			add_task(w, c, cc);
+			w->needs_expose = 1;
 		}
 		return;
 	}
 
+	struct taskbar_task *t = &tw->tasks[ti];
+
 	/* desktop changed (task was moved to other desktop) */
-	if (e->atom == c->atoms[XATOM_NET_WM_DESKTOP]) {
-		struct taskbar_task t = tw->tasks[ti];
-		t.desktop = x_get_window_desktop(c, t.win);
-
-		ARRAY_REMOVE(tw->tasks, (size_t)ti);
-		int insert_after = find_last_task_by_desktop(tw, t.desktop);
-		if (insert_after == -1)
-			ARRAY_PREPEND(tw->tasks, t);
-		else
-			ARRAY_INSERT_AFTER(tw->tasks, (size_t)insert_after, t);
+	if (change == EWMH_CLIENT_DESKTOP) {
+		struct taskbar_task mt = *t;
+		struct taskbar_task_data mtd = tw->task_data[ti];
+		mt.desktop = cc->desktop;
+
+		remove_task_at(w, (size_t)ti);
+		insert_task(w, find_last_task_by_desktop(tw, mt.desktop) + 1,
+			    &mt, &mtd);
 		w->needs_expose = 1;
 		return;
 	}
 
-	/* task name was changed */
-	if (e->atom == tw->tasks[ti].name_atom)
-	{
-		struct taskbar_task *t = &tw->tasks[ti];
-		x_realloc_window_name(&t->name, c, t->win,
-				      &t->name_atom, &t->name_type_atom);
-		w->needs_expose = 1;
+	if (change == EWMH_CLIENT_STATE) {
+		if (!x_is_window_visible_on_panel(c, t->win)) {
+			remove_task(w, ti);
+			w->needs_expose = 1;
+			return;
+		}
+		int demands_attention = x_is_window_demands_attention(c, t->win);
+		if (!demands_attention != !t->demands_attention) {
+			set_task_urgency(w, t, demands_attention);
+			mark_button_dirty(w, t);
+			update_overflow_attention(w);
+		}
 		return;
 	}
 
-	/* icon was changed */
-	if (tw->theme.default_icon) {
-		if (e->atom == c->atoms[XATOM_NET_WM_ICON] ||
-		    e->atom == XA_WM_HINTS)
-		{
-			struct taskbar_task *t = &tw->tasks[ti];
-			cairo_surface_destroy(t->icon);
-			t->icon = get_window_icon(c, t->win, tw->theme.default_icon);
+	/* figure out on which monitor task is located */
+	if (change == EWMH_CLIENT_GEOMETRY && c->monitors_n > 1) {
+		int monitor = client_monitor(w, cc);
+
+		/* finally if task state is changed: redraw! */
+		if (t->monitor != monitor) {
+			t->monitor = monitor;
+			update_task_visibility(w, (size_t)ti);
 			w->needs_expose = 1;
-			return;
 		}
 	}
+}
 
-	if (e->atom == c->atoms[XATOM_NET_WM_STATE] ||
-	    e->atom == c->atoms[XATOM_WM_STATE]) {
-		struct taskbar_task *t = &tw->tasks[ti];
-		if (!x_is_window_visible_on_panel(c, t->win))
-			remove_task(tw, ti);
-		t->demands_attention = x_is_window_demands_attention(c, t->win);
-		w->needs_expose = 1;
+static void add_event_routes(struct widget *w)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	struct x_connection *c = &w->panel->connection;
+	size_t i;
+
+	add_event_route(w, ClientMessage, w->panel->win,
+			c->atoms[XATOM_XDND_POSITION]);
+	for (i = 0; i < tw->tasks_n; ++i)
+		add_event_route(w, PropertyNotify, tw->tasks[i].win, None);
+}
+
+static void scroll_pages(struct widget *w, int delta)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	int page = tw->page + delta;
+	if (page < 0 || page >= tw->pages)
 		return;
-	}
+
+	tw->page = page;
+	invalidate_task_layout(tw);
+	w->needs_expose = 1;
 }
 
 static void button_click(struct widget *w, XButtonEvent *e)
 {
 	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	layout_tasks(w);
+
+	/* paging: wheel over the taskbar or a click on the indicator halves */
+	if (tw->pages > 1) {
+		if (e->type == ButtonPress && (e->button == 4 || e->button == 5)) {
+			scroll_pages(w, e->button == 4 ? -1 : 1);
+			return;
+		}
+		if (e->x >= tw->overflow_x) {
+			if (e->type == ButtonRelease && e->button == 1)
+				scroll_pages(w, e->x < tw->overflow_x + tw->overflow_w / 2 ?
+					     -1 : 1);
+			return;
+		}
+	}
+
 	int ti = get_taskbar_task_at(w, e->x);
 	if (ti == -1)
 		return;
@@ -723,7 +1404,11 @@ static void button_click(struct widget *w, XButtonEvent *e)
 	int mbutton_pin = check_mbutton_condition(w->panel, e->button, MBUTTON_PIN);
 
 	if (e->type == ButtonRelease) {
-		if (mbutton_use) {
+		int next = next_group_task(w, (size_t)ti);
+		if (mbutton_use && next != -1) {
+			activate_task(c, &tw->tasks[next]);
+			w->panel->showing_desktop = 0;
+		} else if (mbutton_use) {
 			if (tw->active == t->win)
 				XIconifyWindow(c->dpy, t->win, c->screen);
 			else {
@@ -736,6 +1421,7 @@ static void button_click(struct widget *w, XButtonEvent *e)
 
 		if (mbutton_pin){
 			t->pinned = t->pinned ? 0 : 1;
+			invalidate_task_layout(tw);
 			w->needs_expose = 1;
 		}
 	}
@@ -826,11 +1512,12 @@ static void dnd_start(struct widget *w, struct drag_info *di)
 		return;
 
 	struct taskbar_task *t = &tw->tasks[ti];
-	if (t->icon) {
+	struct taskbar_task_data *td = &tw->task_data[ti];
+	if (td->icon) {
 		tw->dnd_win = create_window_for_dnd(c,
 						    di->cur_root_x,
 						    di->cur_root_y,
-						    t->icon);
+						    td->icon);
 		XMapWindow(c->dpy, tw->dnd_win);
 	}
 
@@ -864,7 +1551,7 @@ static void dnd_drop(struct widget *w, struct drag_info *di)
 		    tw->tasks[taken].desktop == tw->tasks[dropped].desktop)
 		{
 			/* if the desktop is the same.. move task */
-			move_task(tw, taken, dropped);
+			move_task(w, taken, dropped);
 			w->needs_expose = 1;
 		} else if (!di->dropped_on && taken != -1) {
 			/* out of the panel */
@@ -885,71 +1572,96 @@ static void dnd_drop(struct widget *w, struct drag_info *di)
 	tw->taken = None;
 }
 
-static void mouse_motion(struct widget *w, XMotionEvent *e)
+static int is_pinned_task(struct taskbar_widget *tw, int i)
 {
-	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
-	int i = get_taskbar_task_at(w, e->x);
-	if (i != tw->highlighted) {
-		tw->highlighted = i;
-		w->needs_expose = 1;
-	}
+	return i >= 0 && (size_t)i < tw->tasks_n && tw->tasks[i].pinned;
 }
 
-static void mouse_leave(struct widget *w)
+/* Only the width of pinned buttons depends on the highlight (see
+ * "layout_tasks"), other buttons are just repainted.
+ */
+static void set_highlighted_task(struct widget *w, int i)
 {
 	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
-	if (tw->highlighted != -1) {
-		tw->highlighted = -1;
+	int old = tw->highlighted;
+
+	if (i == old)
+		return;
+	tw->highlighted = i;
+
+	if (is_pinned_task(tw, old) || is_pinned_task(tw, i)) {
+		invalidate_task_layout(tw);
 		w->needs_expose = 1;
+		return;
 	}
+
+	if (old >= 0 && (size_t)old < tw->tasks_n)
+		mark_task_dirty(w, &tw->tasks[old]);
+	if (i >= 0)
+		mark_task_dirty(w, &tw->tasks[i]);
 }
 
-static void clock_tick(struct widget *w)
+static void mouse_motion(struct widget *w, XMotionEvent *e)
 {
-	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
-	size_t i;
-	time_t seconds = time(0);
-	for (i = 0; i < tw->tasks_n; ++i) {
-		struct taskbar_task *t = &tw->tasks[i];
-		if (t->demands_attention > 0) {
-			w->needs_expose = 1;
-			t->demands_attention = 1 + (seconds % 2);
-		}
-	}
+	set_highlighted_task(w, get_taskbar_task_at(w, e->x));
 }
 
-static void configure(struct widget *w, XConfigureEvent *e)
+static void mouse_leave(struct widget *w)
 {
-	struct x_connection *c = &w->panel->connection;
-	const struct x_monitor *monitors = c->monitors;
-	int monitors_n = c->monitors_n;
+	set_highlighted_task(w, -1);
+}
+
+static void update_blinking(struct widget *w)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	time_t seconds = time(0);
+	size_t i;
 
-	/* do nothing if there is only one monitor */
-	if (monitors_n == 1)
+	if (!tw->task_urgency_hint)
 		return;
 
-	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
-	int ti = find_task_by_window(tw, e->window);
-	if (ti != -1) {
+	for (i = 0; i < tw->urgent_n; ++i) {
+		int ti = find_task_by_window(tw, tw->urgent[i]);
+		if (ti == -1)
+			continue;
+
 		struct taskbar_task *t = &tw->tasks[ti];
+		/* activated task stops blinking (see draw_task) */
+		if (t->win == tw->active || !t->demands_attention) {
+			set_task_urgency(w, t, 0);
+			i--;
+		} else
+			t->demands_attention = 1 + (seconds % 2);
+		mark_button_dirty(w, t);
+	}
 
-		/* figure out on which monitor task is located */
-		XWindowAttributes winattrs;
-		XGetWindowAttributes(c->dpy, e->window, &winattrs);
+	update_overflow_attention(w);
+	schedule_blink(w);
+}
 
-		int x, y;
-		x_translate_coordinates(c, 0, 0, &x, &y, e->window);
-		int monitor = task_monitor(x, y, winattrs.width, winattrs.height,
-					   monitors, monitors_n);
+/* delayed name changes, the final title always lands */
+static void update_pending_names(struct widget *w)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	size_t i;
 
-		/* finally if task state is changed: redraw! */
-		if (t->monitor != monitor) {
-			t->monitor = monitor;
-			w->needs_expose = 1;
+	for (i = 0; i < tw->pending_names_n; ++i) {
+		int ti = find_task_by_window(tw, tw->pending_names[i]);
+		if (ti != -1 && !update_task_name(w, (size_t)ti)) {
+			schedule_widget_tick(w, tw->task_data[ti].name_next_update);
+			continue;
 		}
+		ARRAY_REMOVE_UNORDERED(tw->pending_names, i);
+		i--;
 	}
 }
 
+static void clock_tick(struct widget *w)
+{
+	update_blinking(w);
+	update_pending_names(w);
+}
+
 static void reconfigure(struct widget *w)
 {
 	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
@@ -958,7 +1670,14 @@ static void reconfigure(struct widget *w)
 					     &g_settings.root, 50);
 	tw->task_urgency_hint = parse_bool("task_urgency_hint",
 					   &g_settings.root);
+	tw->task_title_rate = parse_int("task_title_rate",
+					&g_settings.root, 4);
+	tw->task_grouping = parse_bool("task_grouping", &g_settings.root);
 	const char *tvmstr = find_config_format_entry_value(&g_settings.root,
 							    "task_visible_monitors");
 	tw->task_visible_monitors = parse_task_visible_monitors(tvmstr);
+	rebuild_visible_tasks(w);
+
+	/* the tick stops itself if there are no urgent tasks */
+	schedule_blink(w);
 }
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <ctype.h>
+#include "settings.h"
 #include "widget-utils.h"
 
 /**************************************************************************
@@ -169,6 +170,13 @@ int parse_triple_image_named(struct triple_image *tri, const char *name,
 	return parse_triple_image(tri, ee, tree, required);
 }
 
+int is_lazy_theme_state(const char *name)
+{
+	if (strcmp(name, "idle_highlight") && strcmp(name, "pressed_highlight"))
+		return 0;
+	return !parse_bool("theme_eager_loading", &g_settings.root);
+}
+
 void free_triple_image(struct triple_image *tbt)
 {
 	if (tbt->center)
@@ -494,16 +502,18 @@ void fill_rectangle(cairo_t *cr, unsigned char *color, struct rect *r)
   Buffer utils
 **************************************************************************/
 
+/* used for window icon pixels only, so it's accounted to msrc_icons */
 static char *static_buf;
 
 void *get_static_buf_or_xalloc(size_t size)
 {
 	if (size <= STATIC_BUF_SIZE) {
 		if (!static_buf)
-			static_buf = xmalloc(STATIC_BUF_SIZE);
+			static_buf = xmalloc_from_source(STATIC_BUF_SIZE,
+							 &msrc_icons);
 		return static_buf;
 	}
-	return xmalloc(size);
+	return xmalloc_from_source(size, &msrc_icons);
 }
 
 void free_static_buf(void *ptr)
@@ -730,19 +740,66 @@ static cairo_surface_t *get_icon_from_pixmap(struct x_connection *c,
 	return ret;
 }
 
+static uint32_t hash_bytes(uint32_t hash, const void *data, size_t len)
+{
+	/* FNV-1a */
+	const unsigned char *p = data;
+	while (len--)
+		hash = (hash ^ *p++) * 16777619u;
+	return hash;
+}
+
+/* "data" is the whole _NET_WM_ICON of "num" longs */
+static void get_icon_cache_key(const char *wm_class,
+			       const long *data, int num, int w, int h,
+			       struct icon_cache_key *key)
+{
+	CLEAR_STRUCT(key);
+	key->width = w;
+	key->height = h;
+	key->data_len = num;
+
+	/* longs are returned as "long", hash their 32-bit values */
+	uint32_t hash = 2166136261u;
+	int i;
+	for (i = 0; i < num; ++i) {
+		uint32_t v = (uint32_t)data[i];
+		hash = hash_bytes(hash, &v, sizeof(v));
+	}
+	key->data_hash = hash;
+
+	hash = 2166136261u;
+	if (wm_class)
+		hash = hash_bytes(hash, wm_class, strlen(wm_class));
+	key->class_hash = hash;
+}
+
 cairo_surface_t *get_window_icon(struct x_connection *c, Window win,
-		cairo_surface_t *default_icon)
+		const char *wm_class, cairo_surface_t *default_icon)
 {
 	cairo_surface_t *ret = 0;
+	int w = image_width(default_icon);
+	int h = image_height(default_icon);
 
+	/* scaled icons are cached on disk, see icon-cache.c */
+	struct icon_cache_key key;
+	cairo_surface_t *cached = 0;
+	int cacheable = 0;
 	int num = 0;
 	long *data = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_ICON],
-			XA_CARDINAL, &num);
-
-	if (data) {
-		ret = get_icon_from_netwm(data,num,image_width(default_icon));
-		XFree(data);
+				     XA_CARDINAL, &num);
+	if (data && num >= 2) {
+		get_icon_cache_key(wm_class, data, num, w, h, &key);
+		cached = find_cached_icon(&key);
+		if (!cached) {
+			ret = get_icon_from_netwm(data, num, w);
+			cacheable = 1;
+		}
 	}
+	if (data)
+		XFree(data);
+	if (cached)
+		return cached;
 
 	if (!ret) {
 	        XWMHints *hints = XGetWMHints(c->dpy, win);
@@ -753,6 +810,7 @@ cairo_surface_t *get_window_icon(struct x_connection *c, Window win,
 			}
 			XFree(hints);
 		}
+		cacheable = 0;
 	}
 
 	if (!ret) {
@@ -760,12 +818,11 @@ cairo_surface_t *get_window_icon(struct x_connection *c, Window win,
 		return default_icon;
 	}
 
-	int w = image_width(default_icon);
-	int h = image_height(default_icon);
-
 	cairo_surface_t *sizedret = copy_resized(ret, w, h);
 	cairo_surface_destroy(ret);
 
+	if (cacheable)
+		add_cached_icon(&key, sizedret);
 	return sizedret;
 }
 
@@ -48,6 +48,11 @@ int parse_triple_image_named(struct triple_image *tri,
 			     int required);
 void free_triple_image(struct triple_image *tri);
 
+/* Optional highlight states are used rarely, their images are parsed on
+ * first use unless "theme_eager_loading" is set in bmpanel2rc.
+ */
+int is_lazy_theme_state(const char *name);
+
 /* text info */
 int parse_text_info(struct text_info *out,
 		    struct config_format_entry *e);
@@ -123,8 +128,10 @@ cairo_t *create_cairo_for_pixmap(struct x_connection *c, Pixmap p, int w, int h)
 cairo_t *create_cairo_for_bitmap(struct x_connection *c, Pixmap p, int w, int h);
 cairo_surface_t *create_cairo_surface_for_pixmap(struct x_connection *c, Pixmap p,
 						 int w, int h);
+/* "wm_class" is the res_class of the window or zero, it's a part of the
+ * icon cache key */
 cairo_surface_t *get_window_icon(struct x_connection *c, Window win,
-				 cairo_surface_t *default_icon);
+				 const char *wm_class, cairo_surface_t *default_icon);
 cairo_surface_t *copy_resized(cairo_surface_t *source, int w, int h);
 
 /**************************************************************************
@@ -81,6 +81,20 @@ char **get_XDG_CONFIG_DIRS(size_t *len)
 			    "/etc/xdg");
 }
 
+char *get_XDG_CACHE_HOME()
+{
+	const char *xdg_cache_home = getenv("XDG_CACHE_HOME");
+	if (xdg_cache_home && xdg_cache_home[0] != '\0')
+		return xstrdup(xdg_cache_home);
+
+	const char *home = getenv("HOME");
+	if (!home)
+		return 0;
+	char *dir = xmalloc(strlen(home) + sizeof("/.cache"));
+	sprintf(dir, "%s/.cache", home);
+	return dir;
+}
+
 void free_XDG(char **ptrs)
 {
 	xfree(ptrs[0]);
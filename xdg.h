@@ -2,5 +2,7 @@
 
 char **get_XDG_DATA_DIRS(size_t *len);
 char **get_XDG_CONFIG_DIRS(size_t *len);
+/* zero if there is no HOME, should be released with xfree */
+char *get_XDG_CACHE_HOME();
 
 void free_XDG(char **ptrs);
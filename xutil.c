@@ -1,4 +1,5 @@
 #include "xutil.h"
+#include "array.h"
 
 /**************************************************************************
   X error handlers
@@ -237,6 +238,226 @@ static void init_monitors(struct x_connection *c)
 	*c->monitors = (struct x_monitor){0,0,c->screen_width,c->screen_height};
 }
 
+/**************************************************************************
+  composite
+**************************************************************************/
+
+static void init_composite(struct x_connection *c)
+{
+#ifdef HAVE_COMPOSITE
+	int event_base, error_base;
+	int major = 0, minor = 0;
+
+	if (!XCompositeQueryExtension(c->dpy, &event_base, &error_base))
+		return;
+	/* XCompositeNameWindowPixmap appeared in 0.2 */
+	XCompositeQueryVersion(c->dpy, &major, &minor);
+	if (major == 0 && minor < 2)
+		return;
+	if (!XDamageQueryExtension(c->dpy, &c->damage_event_base, &error_base))
+		return;
+	if (!XRenderQueryExtension(c->dpy, &event_base, &error_base))
+		return;
+
+	XVisualInfo vi;
+	if (!XMatchVisualInfo(c->dpy, c->screen, 32, TrueColor, &vi))
+		return;
+
+	c->composite = 1;
+	c->argb_visual = vi.visual;
+	c->argb_colormap = XCreateColormap(c->dpy, c->root, vi.visual, AllocNone);
+#endif
+}
+
+/**************************************************************************
+  window properties cache
+**************************************************************************/
+
+/* Decoded state of client windows, every property is fetched once and then
+ * stays cached until PropertyNotify for it arrives (see
+ * x_window_prop_changed). Entries are kept sorted by window id.
+ */
+
+enum {
+	XPROP_WINDOW_TYPE	= 1 << 0,
+	XPROP_WM_STATE		= 1 << 1,
+	XPROP_NET_WM_STATE	= 1 << 2,
+	XPROP_WM_HINTS		= 1 << 3
+};
+
+enum {
+	XWIN_DOCK_OR_DESKTOP	= 1 << 0, /* _NET_WM_WINDOW_TYPE */
+	XWIN_WITHDRAWN		= 1 << 1, /* WM_STATE */
+	XWIN_ICONIC		= 1 << 2,
+	XWIN_SKIP_TASKBAR	= 1 << 3, /* _NET_WM_STATE */
+	XWIN_HIDDEN		= 1 << 4,
+	XWIN_DEMANDS_ATTENTION	= 1 << 5,
+	XWIN_URGENT		= 1 << 6  /* WM_HINTS */
+};
+
+static const unsigned int prop_flags[] = {
+	XWIN_DOCK_OR_DESKTOP,
+	XWIN_WITHDRAWN | XWIN_ICONIC,
+	XWIN_SKIP_TASKBAR | XWIN_HIDDEN | XWIN_DEMANDS_ATTENTION,
+	XWIN_URGENT
+};
+
+static int find_window_props(struct x_connection *c, Window win, size_t *pos)
+{
+	size_t lo = 0, hi = c->wprops_n;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (c->wprops[mid].win < win)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*pos = lo;
+	return lo < c->wprops_n && c->wprops[lo].win == win;
+}
+
+static unsigned int fetch_window_prop(struct x_connection *c, Window win,
+				      unsigned int prop)
+{
+	unsigned int flags = 0;
+	Atom *atoms;
+	unsigned long *state;
+	int num;
+
+	switch (prop) {
+	case XPROP_WINDOW_TYPE:
+		atoms = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_WINDOW_TYPE],
+					XA_ATOM, &num);
+		if (!atoms)
+			break;
+		while (num--) {
+			if (atoms[num] == c->atoms[XATOM_NET_WM_WINDOW_TYPE_DOCK] ||
+			    atoms[num] == c->atoms[XATOM_NET_WM_WINDOW_TYPE_DESKTOP])
+				flags |= XWIN_DOCK_OR_DESKTOP;
+		}
+		XFree(atoms);
+		break;
+	case XPROP_WM_STATE:
+		state = x_get_prop_data(c, win, c->atoms[XATOM_WM_STATE],
+					c->atoms[XATOM_WM_STATE], 0);
+		if (!state)
+			break;
+		if (state[0] == WithdrawnState)
+			flags |= XWIN_WITHDRAWN;
+		else if (state[0] == IconicState)
+			flags |= XWIN_ICONIC;
+		XFree(state);
+		break;
+	case XPROP_NET_WM_STATE:
+		atoms = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_STATE],
+					XA_ATOM, &num);
+		if (!atoms)
+			break;
+		while (num--) {
+			if (atoms[num] == c->atoms[XATOM_NET_WM_STATE_SKIP_TASKBAR])
+				flags |= XWIN_SKIP_TASKBAR;
+			else if (atoms[num] == c->atoms[XATOM_NET_WM_STATE_HIDDEN])
+				flags |= XWIN_HIDDEN;
+			else if (atoms[num] == c->atoms[XATOM_NET_WM_STATE_DEMANDS_ATTENTION])
+				flags |= XWIN_DEMANDS_ATTENTION;
+		}
+		XFree(atoms);
+		break;
+	case XPROP_WM_HINTS: {
+		XWMHints *wmh = XGetWMHints(c->dpy, win);
+		if (!wmh)
+			break;
+		if (wmh->flags & XUrgencyHint)
+			flags |= XWIN_URGENT;
+		XFree(wmh);
+		break;
+	}
+	}
+	return flags;
+}
+
+/* Adds an empty entry at "pos", returns false if the window is gone. We
+ * need PropertyNotify to keep the entry valid and DestroyNotify to drop it.
+ * If the window is already gone, do not cache anything, its id can be
+ * reused.
+ */
+static int add_window_props(struct x_connection *c, Window win, size_t pos)
+{
+	XWindowAttributes winattrs;
+	if (!XGetWindowAttributes(c->dpy, win, &winattrs))
+		return 0;
+	if (win != c->root)
+		XSelectInput(c->dpy, win, winattrs.your_event_mask |
+			     PropertyChangeMask | StructureNotifyMask);
+
+	struct x_window_props nwp = {win, 0, 0};
+	if (pos == c->wprops_n)
+		ARRAY_APPEND(c->wprops, nwp);
+	else
+		ARRAY_INSERT_BEFORE(c->wprops, pos, nwp);
+	return 1;
+}
+
+/* returns XWIN_* flags, "props" is a mask of XPROP_* which should be valid */
+static unsigned int get_window_props(struct x_connection *c, Window win,
+				     unsigned int props)
+{
+	struct x_window_props *wp;
+	size_t pos;
+	size_t i;
+
+	if (!find_window_props(c, win, &pos) && !add_window_props(c, win, pos)) {
+		unsigned int flags = 0;
+		for (i = 0; i < sizeof(prop_flags) / sizeof(prop_flags[0]); ++i) {
+			if (props & (1 << i))
+				flags |= fetch_window_prop(c, win, 1 << i);
+		}
+		return flags;
+	}
+
+	wp = &c->wprops[pos];
+	for (i = 0; i < sizeof(prop_flags) / sizeof(prop_flags[0]); ++i) {
+		unsigned int prop = 1 << i;
+		if (!(props & prop) || (wp->fetched & prop))
+			continue;
+
+		wp->flags &= ~prop_flags[i];
+		wp->flags |= fetch_window_prop(c, win, prop);
+		wp->fetched |= prop;
+	}
+	return wp->flags;
+}
+
+int x_watch_window(struct x_connection *c, Window win)
+{
+	size_t pos;
+	return find_window_props(c, win, &pos) || add_window_props(c, win, pos);
+}
+
+void x_window_prop_changed(struct x_connection *c, Window win, Atom atom)
+{
+	size_t pos;
+	if (!find_window_props(c, win, &pos))
+		return;
+
+	struct x_window_props *wp = &c->wprops[pos];
+	if (atom == c->atoms[XATOM_NET_WM_WINDOW_TYPE])
+		wp->fetched &= ~XPROP_WINDOW_TYPE;
+	else if (atom == c->atoms[XATOM_WM_STATE])
+		wp->fetched &= ~XPROP_WM_STATE;
+	else if (atom == c->atoms[XATOM_NET_WM_STATE])
+		wp->fetched &= ~XPROP_NET_WM_STATE;
+	else if (atom == XA_WM_HINTS)
+		wp->fetched &= ~XPROP_WM_HINTS;
+}
+
+void x_window_destroyed(struct x_connection *c, Window win)
+{
+	size_t pos;
+	if (find_window_props(c, win, &pos))
+		ARRAY_REMOVE(c->wprops, pos);
+}
+
 /**************************************************************************
   *the* interface
 **************************************************************************/
@@ -269,11 +490,13 @@ void x_connect(struct x_connection *c, const char *display)
 	XSelectInput(c->dpy, c->root, PropertyChangeMask | StructureNotifyMask);
 
 	init_monitors(c);
+	init_composite(c);
 }
 
 void x_disconnect(struct x_connection *c)
 {
 	xfree(c->monitors);
+	FREE_ARRAY(c->wprops);
 	if (c->argb_visual)
 		XFreeColormap(c->dpy, c->argb_colormap);
 	XCloseDisplay(c->dpy);
@@ -345,152 +568,88 @@ void x_set_prop_array(struct x_connection *c, Window win, Atom type,
 
 int x_is_window_visible_on_panel(struct x_connection *c, Window win)
 {
-	Atom *data;
-	int ret = 1;
-	int num;
-
-	data = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_WINDOW_TYPE],
-			XA_ATOM, &num);
-	if (data) {
-		while (num) {
-			num--;
-			if (data[num] == c->atoms[XATOM_NET_WM_WINDOW_TYPE_DOCK] ||
-			    data[num] == c->atoms[XATOM_NET_WM_WINDOW_TYPE_DESKTOP])
-			{
-				XFree(data);
-				return 0;
-			}
-
-		}
-		XFree(data);
-	}
-
-	data = x_get_prop_data(c, win, c->atoms[XATOM_WM_STATE],
-			       c->atoms[XATOM_WM_STATE], 0);
-	if (data) {
-		if (data[0] == WithdrawnState) {
-			XFree(data);
-			return 0;
-		}
-		XFree(data);
-	}
-
-	data = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_STATE], XA_ATOM, &num);
-	if (!data)
-		return 1;
-
-	while (num) {
-		num--;
-		if (data[num] == c->atoms[XATOM_NET_WM_STATE_SKIP_TASKBAR])
-			ret = 0;
-	}
-	XFree(data);
-
-	return ret;
+	unsigned int flags = get_window_props(c, win, XPROP_WINDOW_TYPE |
+					      XPROP_WM_STATE | XPROP_NET_WM_STATE);
+	return !(flags & (XWIN_DOCK_OR_DESKTOP | XWIN_WITHDRAWN |
+			  XWIN_SKIP_TASKBAR));
 }
 
 int x_is_window_visible_on_screen(struct x_connection *c, Window win)
 {
-	Atom *data;
-	int ret = 1;
-	int num;
-
-	data = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_WINDOW_TYPE],
-			XA_ATOM, &num);
-	if (data) {
-		while (num) {
-			num--;
-			if (data[num] == c->atoms[XATOM_NET_WM_WINDOW_TYPE_DOCK] ||
-			    data[num] == c->atoms[XATOM_NET_WM_WINDOW_TYPE_DESKTOP])
-			{
-				XFree(data);
-				return 0;
-			}
-
-		}
-		XFree(data);
-	}
-
-	data = x_get_prop_data(c, win, c->atoms[XATOM_WM_STATE],
-			       c->atoms[XATOM_WM_STATE], 0);
-	if (data) {
-		if (data[0] == WithdrawnState) {
-			XFree(data);
-			return 0;
-		}
-		XFree(data);
-	}
-
-	data = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_STATE], XA_ATOM, &num);
-	if (!data)
-		return 1;
-
-	while (num) {
-		num--;
-		if (data[num] == c->atoms[XATOM_NET_WM_STATE_SKIP_TASKBAR] ||
-		    data[num] == c->atoms[XATOM_NET_WM_STATE_HIDDEN])
-			ret = 0;
-	}
-	XFree(data);
-
-	return ret;
+	unsigned int flags = get_window_props(c, win, XPROP_WINDOW_TYPE |
+					      XPROP_WM_STATE | XPROP_NET_WM_STATE);
+	return !(flags & (XWIN_DOCK_OR_DESKTOP | XWIN_WITHDRAWN |
+			  XWIN_SKIP_TASKBAR | XWIN_HIDDEN));
 }
 
 int x_is_window_demands_attention(struct x_connection *c, Window win)
 {
-	Atom *data;
-	int ret = 0;
-	int num;
+	unsigned int flags = get_window_props(c, win, XPROP_WM_HINTS |
+					      XPROP_NET_WM_STATE);
+	return (flags & (XWIN_URGENT | XWIN_DEMANDS_ATTENTION)) != 0;
+}
 
-	XWMHints *wmh = XGetWMHints(c->dpy, win);
-	if (wmh) {
-		if (wmh->flags & XUrgencyHint) {
-			XFree(wmh);
-			return 1;
-		}
-		XFree(wmh);
-	}
+int x_is_window_iconified(struct x_connection *c, Window win)
+{
+	unsigned int flags = get_window_props(c, win, XPROP_WM_STATE |
+					      XPROP_NET_WM_STATE);
+	return (flags & (XWIN_ICONIC | XWIN_HIDDEN)) != 0;
+}
 
-	data = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_STATE], XA_ATOM, &num);
-	if (!data)
-		return 0;
+/* Titles longer than that are cut, there is no space for them anyway. Size
+ * is in 32-bit units, as XGetWindowProperty wants it.
+ */
+#define WINDOW_NAME_MAX_LONGS 128
 
-	while (num) {
-		num--;
-		if (data[num] == c->atoms[XATOM_NET_WM_STATE_DEMANDS_ATTENTION])
-			ret = 1;
-	}
-	XFree(data);
+/* cut incomplete UTF-8 sequence at the end of the string */
+static void trim_partial_utf8(char *str, size_t len)
+{
+	size_t i = len;
+	while (i > 0 && (str[i-1] & 0xC0) == 0x80 && len - i < 3)
+		i--;
+	if (i == 0 || !(str[i-1] & 0x80))
+		return;
 
-	return ret;
+	unsigned char lead = str[i-1];
+	size_t need = 1;
+	if ((lead & 0xE0) == 0xC0)
+		need = 2;
+	else if ((lead & 0xF0) == 0xE0)
+		need = 3;
+	else if ((lead & 0xF8) == 0xF0)
+		need = 4;
+	if (len - (i-1) < need)
+		str[i-1] = '\0';
 }
 
-int x_is_window_iconified(struct x_connection *c, Window win)
+static char *get_window_name_prop(struct x_connection *c, Window win,
+				  Atom prop, Atom *atype)
 {
-	unsigned long *data;
-	int ret = 0;
+	Atom type_ret;
+	int format_ret;
+	unsigned long items_ret;
+	unsigned long after_ret;
+	unsigned char *prop_data = 0;
 
-	data = x_get_prop_data(c, win, c->atoms[XATOM_WM_STATE],
-			       c->atoms[XATOM_WM_STATE], 0);
-	if (data) {
-		if (data[0] == IconicState) {
-			ret = 1;
-		}
-		XFree(data);
-	}
+	XGetWindowProperty(c->dpy, win, prop, 0, WINDOW_NAME_MAX_LONGS, False,
+			   AnyPropertyType, &type_ret, &format_ret, &items_ret,
+			   &after_ret, &prop_data);
+	if (!prop_data)
+		return 0;
 
-	int num;
-	data = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_STATE], XA_ATOM, &num);
-	if (data) {
-		while (num) {
-			num--;
-			if (data[num] == c->atoms[XATOM_NET_WM_STATE_HIDDEN])
-				ret = 1;
-		}
-		XFree(data);
+	if (format_ret != 8 || !items_ret ||
+	    (type_ret != XA_STRING && type_ret != c->atoms[XATOM_UTF8_STRING]) ||
+	    (*atype != None && type_ret != *atype))
+	{
+		XFree(prop_data);
+		return 0;
 	}
 
-	return ret;
+	/* Xlib always adds a terminating zero */
+	if (after_ret && type_ret == c->atoms[XATOM_UTF8_STRING])
+		trim_partial_utf8((char*)prop_data, items_ret);
+	*atype = type_ret;
+	return (char*)prop_data;
 }
 
 void x_realloc_window_name(struct strbuf *sb, struct x_connection *c,
@@ -499,77 +658,54 @@ void x_realloc_window_name(struct strbuf *sb, struct x_connection *c,
 	char *name = 0;
 	if (*atom != None) {
 		/* fast path */
-		name = x_get_prop_data(c, win, *atom, *atype, 0);
+		name = get_window_name_prop(c, win, *atom, atype);
 		if (name)
 			goto name_here;
 	}
-	/****************/
-	*atype = c->atoms[XATOM_UTF8_STRING];
-	*atom = c->atoms[XATOM_NET_WM_VISIBLE_ICON_NAME];
-
-	name = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_VISIBLE_ICON_NAME],
-			c->atoms[XATOM_UTF8_STRING], 0);
-	if (name)
-		goto name_here;
-	/****************/
-	*atype = c->atoms[XATOM_UTF8_STRING];
-	*atom = c->atoms[XATOM_NET_WM_ICON_NAME];
-
-	name = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_ICON_NAME],
-			c->atoms[XATOM_UTF8_STRING], 0);
-	if (name)
-		goto name_here;
-	/****************/
-	*atype = XA_STRING;
-	*atom = XA_WM_ICON_NAME;
-
-	name = x_get_prop_data(c, win, XA_WM_ICON_NAME, XA_STRING, 0);
-	if (name)
-		goto name_here;
-	/****************/
-	*atype = c->atoms[XATOM_UTF8_STRING];
-	*atom = XA_WM_ICON_NAME;
-
-	name = x_get_prop_data(c, win, XA_WM_ICON_NAME, c->atoms[XATOM_UTF8_STRING], 0);
-	if (name)
-		goto name_here;
-	/****************/
-	*atype = c->atoms[XATOM_UTF8_STRING];
-	*atom = c->atoms[XATOM_NET_WM_VISIBLE_NAME];
-
-	name = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_VISIBLE_NAME],
-			c->atoms[XATOM_UTF8_STRING], 0);
-	if (name)
-		goto name_here;
-	/****************/
-	*atype = c->atoms[XATOM_UTF8_STRING];
-	*atom = c->atoms[XATOM_NET_WM_NAME];
-
-	name = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_NAME],
-			c->atoms[XATOM_UTF8_STRING], 0);
-	if (name)
-		goto name_here;
-	/****************/
-	*atype = XA_STRING;
-	*atom = XA_WM_NAME;
-
-	name = x_get_prop_data(c, win, XA_WM_NAME, XA_STRING, 0);
-	if (name)
-		goto name_here;
-	/****************/
-	*atype = c->atoms[XATOM_UTF8_STRING];
-	*atom = XA_WM_NAME;
-
-	name = x_get_prop_data(c, win, XA_WM_NAME, c->atoms[XATOM_UTF8_STRING], 0);
-	if (name)
-		goto name_here;
-	else {
+
+	/* candidates in order of preference, None type means STRING or
+	 * UTF8_STRING
+	 */
+	const Atom candidates[][2] = {
+		{c->atoms[XATOM_NET_WM_VISIBLE_ICON_NAME], c->atoms[XATOM_UTF8_STRING]},
+		{c->atoms[XATOM_NET_WM_ICON_NAME], c->atoms[XATOM_UTF8_STRING]},
+		{XA_WM_ICON_NAME, None},
+		{c->atoms[XATOM_NET_WM_VISIBLE_NAME], c->atoms[XATOM_UTF8_STRING]},
+		{c->atoms[XATOM_NET_WM_NAME], c->atoms[XATOM_UTF8_STRING]},
+		{XA_WM_NAME, None}
+	};
+
+	/* one round-trip to find out which of them are present, then fetch
+	 * only the best one
+	 */
+	int props_n = 0;
+	Atom *props = XListProperties(c->dpy, win, &props_n);
+	size_t i;
+	int j;
+	for (i = 0; i < sizeof(candidates) / sizeof(candidates[0]); ++i) {
+		for (j = 0; j < props_n; ++j) {
+			if (props[j] == candidates[i][0])
+				break;
+		}
+		if (j == props_n)
+			continue;
+
+		*atom = candidates[i][0];
+		*atype = candidates[i][1];
+		name = get_window_name_prop(c, win, *atom, atype);
+		if (name)
+			break;
+	}
+	if (props)
+		XFree(props);
+
+	if (!name) {
 		*atom = None;
 		*atype = None;
 		strbuf_assign(sb, "<unknown>");
 		return;
 	}
-	/****************/
+
 name_here:
 	strbuf_assign(sb, name);
 	XFree(name);
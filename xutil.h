@@ -16,6 +16,12 @@
  #include <X11/extensions/Xrandr.h>
 #endif
 
+#ifdef HAVE_COMPOSITE
+ #include <X11/extensions/Xcomposite.h>
+ #include <X11/extensions/Xdamage.h>
+ #include <X11/extensions/Xrender.h>
+#endif
+
 enum x_atom {
 	XATOM_WM_STATE,
 	XATOM_NET_DESKTOP_NAMES,
@@ -65,6 +71,13 @@ struct x_monitor {
 	int height;
 };
 
+/* see "window properties cache" in xutil.c */
+struct x_window_props {
+	Window win;
+	unsigned int fetched;
+	unsigned int flags;
+};
+
 struct x_connection {
 	Display *dpy;
 
@@ -79,13 +92,23 @@ struct x_connection {
 	Colormap default_colormap;
 	int default_depth;
 
+	/* zero if there is no 32-bit visual or no composite support */
 	Visual *argb_visual;
 	Colormap argb_colormap;
 
+	/* bool, XComposite, XDamage and XRender are usable */
+	int composite;
+	int damage_event_base;
+
 	Window root;
 	Pixmap root_pixmap;
 
 	Atom atoms[XATOM_COUNT];
+
+	/* array, sorted by window id */
+	struct x_window_props *wprops;
+	size_t wprops_n;
+	size_t wprops_alloc;
 };
 
 void x_connect(struct x_connection *c, const char *display);
@@ -136,6 +159,16 @@ int x_is_window_visible_on_screen(struct x_connection *c, Window win);
 int x_is_window_iconified(struct x_connection *c, Window win);
 int x_is_window_demands_attention(struct x_connection *c, Window win);
 
+/* Selects property and structure events on the window and starts caching
+ * its state, returns false if the window is gone. Client windows get their
+ * input selected only here.
+ */
+int x_watch_window(struct x_connection *c, Window win);
+
+/* keep cached window state in sync, call on PropertyNotify/DestroyNotify */
+void x_window_prop_changed(struct x_connection *c, Window win, Atom atom);
+void x_window_destroyed(struct x_connection *c, Window win);
+
 void x_realloc_window_name(struct strbuf *sb, struct x_connection *c,
 			   Window win, Atom *atom, Atom *atype);
 